@@ -0,0 +1,106 @@
+/*
+ * scale_bench.c - Compare the integer scaler of render.c with SDL_SoftStretch
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Usage: SDL_VIDEODRIVER=dummy scale_bench [frames]
+ *
+ * For 2x and 3x prints the cost of a full frame and of a small dirty
+ * region going through render_flush(), then of the same full frame
+ * stretched by SDL_SoftStretch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <SDL.h>
+
+#include "../render.h"
+
+static long elapsed_us(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1000000L + (t1.tv_nsec - t0->tv_nsec) / 1000;
+}
+
+static void bench_render(int frames, const SDL_Rect *dirty, const char *what)
+{
+	struct timespec t0;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < frames; i++) {
+		render_fill(dirty, i & 1 ? UI_WHITE : UI_BLACK);
+		render_flush();
+	}
+
+	printf("  render %-6s %7.1f us/frame\n", what, (double)elapsed_us(&t0) / frames);
+}
+
+static void bench_stretch(SDL_Surface *screen, int n, int frames)
+{
+	SDL_Surface *src;
+	SDL_Rect src_rect = { 0, 0, FB_WIDTH, FB_HEIGHT };
+	SDL_Rect dst_rect;
+	struct timespec t0;
+	int i;
+
+	src = SDL_CreateRGBSurface(SDL_SWSURFACE, FB_WIDTH, FB_HEIGHT, 8, 0, 0, 0, 0);
+	if (!src)
+		return;
+
+	dst_rect.x = (screen->w - FB_WIDTH * n) / 2;
+	dst_rect.y = (screen->h - FB_HEIGHT * n) / 2;
+	dst_rect.w = FB_WIDTH * n;
+	dst_rect.h = FB_HEIGHT * n;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < frames; i++) {
+		SDL_SoftStretch(src, &src_rect, screen, &dst_rect);
+		SDL_UpdateRect(screen, dst_rect.x, dst_rect.y, dst_rect.w, dst_rect.h);
+	}
+
+	printf("  SoftStretch   %7.1f us/frame\n", (double)elapsed_us(&t0) / frames);
+	SDL_FreeSurface(src);
+}
+
+int main(int argc, char *argv[])
+{
+	SDL_Rect full = { 0, 0, FB_WIDTH, FB_HEIGHT };
+	SDL_Rect bar = { FB_WIDTH - 20, FB_HEIGHT - 70, 20, 65 };
+	int frames = argc > 1 ? atoi(argv[1]) : 500;
+	int n;
+
+	if (frames < 1)
+		frames = 1;
+
+	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+		fprintf(stderr, "Cannot init SDL\n");
+		return 1;
+	}
+
+	for (n = 2; n <= RENDER_MAX_SCALE; n++) {
+		SDL_Surface *screen;
+
+		screen = SDL_SetVideoMode(FB_WIDTH * n, FB_HEIGHT * n, 8, SDL_SWSURFACE);
+		if (!screen || render_init(screen) < 0) {
+			fprintf(stderr, "Cannot set a %dx%d mode\n", FB_WIDTH * n, FB_HEIGHT * n);
+			continue;
+		}
+
+		printf("%dx (%dx%d), %d frames\n", n, screen->w, screen->h, frames);
+		bench_render(frames, &full, "full");
+		bench_render(frames, &bar, "dirty");
+		bench_stretch(screen, n, frames);
+	}
+
+	SDL_Quit();
+	return 0;
+}
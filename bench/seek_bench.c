@@ -0,0 +1,92 @@
+/*
+ * seek_bench.c - Measure the software seek against the simulated tuner
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Usage: seek_bench [lock time in us] [region]
+ *
+ * Seeks upward from the bottom of the band until it wraps, so the whole
+ * band is covered once, and prints the cost of each seek. Then scans the
+ * band with 1 to 4 simulated tuners. The region names the band plan, as
+ * in ~/.radioplayer/region.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../tuner.h"
+#include "../tuner_sim.h"
+
+static void bench_scan(int count, long lock_us)
+{
+	struct tuner_dev devs[MAX_TUNERS];
+	struct station stations[128];
+	long elapsed = 0;
+	int i, found;
+
+	for (i = 0; i < count; i++)
+		tuner_dev_init(&devs[i], tuner_sim_open(lock_us), "sim");
+
+	found = tuner_scan(devs, count, stations, 128, &elapsed);
+	printf("scan with %d tuners: %d stations, %ld ms\n", count, found, elapsed);
+
+	for (i = 0; i < count; i++)
+		tuner_dev_close(&devs[i]);
+}
+
+int main(int argc, char *argv[])
+{
+	struct tuner_dev dev;
+	struct sw_seek_stats stats;
+	long lock_us = argc > 1 ? atol(argv[1]) : TUNER_SIM_LOCK_US;
+	long total_ms = 0;
+	int i, found = 0, probes = 0, refines = 0;
+	unsigned int khz, prev;
+
+	if (argc > 2)
+		band_select(band_find(argv[2]));
+	khz = band_active()->min_khz;
+	printf("band %s, %u channels\n", band_active()->name, band_active()->channels);
+
+	if (tuner_dev_init(&dev, tuner_sim_open(lock_us), "sim") < 0)
+		return 1;
+
+	printf("simulated lock time %ld us, hw seek %s\n", lock_us,
+			dev.hw_seek ? "yes" : "no");
+
+	for (;;) {
+		prev = khz;
+
+		if (sw_seek(&dev, &khz, 1, &stats) < 0) {
+			printf("no station found\n");
+			break;
+		}
+
+		printf("%6.1f MHz  %3d probes  %2d refines  %5ld ms  settle %5ld us\n",
+				khz / 1000.0, stats.probes, stats.refines,
+				stats.elapsed_ms, stats.settle_us);
+
+		found++;
+		probes += stats.probes;
+		refines += stats.refines;
+		total_ms += stats.elapsed_ms;
+
+		/* wrapped around the band */
+		if (khz <= prev)
+			break;
+	}
+
+	printf("full band: %d stations, %d probes, %d refines, %ld ms\n",
+			found, probes, refines, total_ms);
+
+	tuner_dev_close(&dev);
+
+	for (i = 1; i <= 4; i++)
+		bench_scan(i, lock_us);
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * capture.c - Line In capture thread. It reads one period at a time from
+ *             ALSA and hands it to every registered tap, so the audio is
+ *             captured once no matter how many modules need it.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <alsa/asoundlib.h>
+#include <pthread.h>
+
+#include "capture.h"
+
+struct tap_entry {
+	capture_tap tap;
+	void *data;
+};
+
+static struct tap_entry taps[CAPTURE_MAX_TAPS];
+static int num_taps;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+
+static snd_pcm_t *pcm;
+static int users;
+static volatile int running;
+
+static void *capture_thread(void *arg)
+{
+	static short frames[CAPTURE_PERIOD * CAPTURE_CHANNELS];
+	int i;
+
+	while (running) {
+		snd_pcm_sframes_t n = snd_pcm_readi(pcm, frames, CAPTURE_PERIOD);
+
+		if (n < 0) {
+			if (snd_pcm_recover(pcm, n, 1) < 0) {
+				fprintf(stderr, "capture: %s\n", snd_strerror(n));
+				break;
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&lock);
+		for (i = 0; i < num_taps; i++)
+			taps[i].tap(frames, n, taps[i].data);
+		pthread_mutex_unlock(&lock);
+	}
+
+	return NULL;
+}
+
+int capture_start(void)
+{
+	int err;
+
+	if (users++)
+		return 0;
+
+	err = snd_pcm_open(&pcm, CAPTURE_DEVICE, SND_PCM_STREAM_CAPTURE, 0);
+	if (err < 0) {
+		fprintf(stderr, "Cannot open capture device: %s\n", snd_strerror(err));
+		users = 0;
+		return -1;
+	}
+
+	/* keep the buffer short, the taps want fresh audio */
+	err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
+			CAPTURE_CHANNELS, CAPTURE_RATE, 1, 40000);
+	if (err < 0) {
+		fprintf(stderr, "Cannot set capture params: %s\n", snd_strerror(err));
+		snd_pcm_close(pcm);
+		users = 0;
+		return -1;
+	}
+
+	running = 1;
+	if (pthread_create(&thread, NULL, capture_thread, NULL)) {
+		fprintf(stderr, "Cannot start the capture thread\n");
+		running = 0;
+		snd_pcm_close(pcm);
+		users = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void capture_stop(void)
+{
+	if (!users || --users)
+		return;
+
+	running = 0;
+	pthread_join(thread, NULL);
+	snd_pcm_close(pcm);
+}
+
+int capture_add_tap(capture_tap tap, void *data)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&lock);
+	if (num_taps < CAPTURE_MAX_TAPS) {
+		taps[num_taps].tap = tap;
+		taps[num_taps].data = data;
+		num_taps++;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+void capture_remove_tap(capture_tap tap, void *data)
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < num_taps; i++) {
+		if (taps[i].tap == tap && taps[i].data == data) {
+			taps[i] = taps[--num_taps];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,29 @@
+/*
+ * capture.h - Line In capture shared by every module that needs the
+ *             radio audio
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define CAPTURE_DEVICE "default"
+#define CAPTURE_RATE 44100
+#define CAPTURE_CHANNELS 2
+
+/* frames delivered to the taps at once, 10 ms */
+#define CAPTURE_PERIOD 441
+
+#define CAPTURE_MAX_TAPS 8
+
+/* called from the capture thread with interleaved S16 frames, must be quick */
+typedef void (*capture_tap)(const short *frames, unsigned int count, void *data);
+
+/* The capture runs while there is at least one user. Returns 0 on success. */
+int capture_start(void);
+void capture_stop(void);
+
+int capture_add_tap(capture_tap tap, void *data);
+void capture_remove_tap(capture_tap tap, void *data);
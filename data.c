@@ -16,6 +16,7 @@
  */
 
 #include <dirent.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,7 +24,13 @@
 #include <sys/stat.h>
 
 #include "data.h"
+#include "dsp.h"
+#include "loudness.h"
 #include "radio.h"
+#include "sched.h"
+#include "state.h"
+#include "trace.h"
+#include "tuner.h"
 
 /* Path to the radio player dir */
 static char path[255];
@@ -34,6 +41,12 @@ static char aux_path[255];
 /* Auxiliary FILE pointer */
 FILE *file = NULL;
 
+/* settings writes go to the flight recorder too, see trace.h */
+static void trace_setting(int setting, long value, FILE *f)
+{
+	trace_add(TRACE_SETTING, setting, value, f ? 0 : -errno, 0);
+}
+
 /* verify if the home/.radioplayer dir exists */
 static int verify_dir(void)
 {
@@ -77,13 +90,14 @@ void handle_user_freq(int mode, float *freq)
 
 		} else if (mode == FILE_FREQ_WRITE) {
 			file = fopen(aux_path, "w");
+			trace_setting(TRACE_SET_FREQ, *freq * 1000 + 0.5f, file);
 		
 			if (!file) {
 				fprintf(stderr, "Cannot store the curr freq!\n");
 				return;
 			}
 
-			fprintf(file, "%.1f", *freq);
+			fprintf(file, "%.2f", *freq);
 		}
 
 		if (file)
@@ -111,6 +125,7 @@ void handle_sound_level(int mode, long *volume)
 
 		} else if (mode == FILE_VOLUME_WRITE) {
 			file = fopen(aux_path, "w");
+			trace_setting(TRACE_SET_VOLUME, *volume, file);
 
 			if (!file) {
 				fprintf(stderr, "Cannot set the actual volume level!\n");
@@ -140,6 +155,7 @@ void handle_mode(int mode, int *value)
 			sscanf(aux_mode, "%d", value);
 		} else if (mode == MODE_SET) {
 			file = fopen(aux_path, "w");
+			trace_setting(TRACE_SET_MODE, *value, file);
 
 			if (!file) {
 				fprintf(stderr, "Cannot set the actual mode!\n");
@@ -154,6 +170,270 @@ void handle_mode(int mode, int *value)
 	}
 }
 
+void handle_seek_verify(int mode, int *value)
+{
+	char aux_value[2];
+
+	if (path[0] != '0') {
+		sprintf(aux_path, "%s/%s", path, "seek_verify");
+		if (mode == MODE_GET) {
+			file = fopen(aux_path, "r");
+
+			if (!file)
+				return;
+
+			fgets(aux_value, 2, file);
+			sscanf(aux_value, "%d", value);
+		} else if (mode == MODE_SET) {
+			file = fopen(aux_path, "w");
+			trace_setting(TRACE_SET_SEEK_VERIFY, *value, file);
+
+			if (!file) {
+				fprintf(stderr, "Cannot set the seek verification!\n");
+				return;
+			}
+
+			fprintf(file, "%i", *value);
+		}
+
+		if (file)
+			fclose(file);
+	}
+}
+
+void handle_stream_port(int mode, int *port)
+{
+	char aux_port[7];
+
+	if (path[0] != '0') {
+		sprintf(aux_path, "%s/%s", path, "stream_port");
+		if (mode == MODE_GET) {
+			file = fopen(aux_path, "r");
+
+			if (!file)
+				return;
+
+			fgets(aux_port, 7, file);
+			sscanf(aux_port, "%d", port);
+		} else if (mode == MODE_SET) {
+			file = fopen(aux_path, "w");
+			trace_setting(TRACE_SET_STREAM_PORT, *port, file);
+
+			if (!file) {
+				fprintf(stderr, "Cannot set the stream port!\n");
+				return;
+			}
+
+			fprintf(file, "%i", *port);
+		}
+
+		if (file)
+			fclose(file);
+	}
+}
+
+/* one line: enabled latency_ms bass_db and the gain of each EQ band */
+void handle_dsp(int mode, struct dsp_settings *dsp)
+{
+	int i;
+
+	if (path[0] != '0') {
+		sprintf(aux_path, "%s/%s", path, "dsp");
+		if (mode == MODE_GET) {
+			file = fopen(aux_path, "r");
+
+			if (!file)
+				return;
+
+			if (fscanf(file, "%d %d %d", &dsp->enabled, &dsp->latency_ms,
+						&dsp->bass_db) == 3)
+				for (i = 0; i < DSP_EQ_BANDS; i++)
+					if (fscanf(file, "%d", &dsp->eq_db[i]) != 1)
+						break;
+		} else if (mode == MODE_SET) {
+			file = fopen(aux_path, "w");
+			trace_setting(TRACE_SET_DSP, dsp->enabled, file);
+
+			if (!file) {
+				fprintf(stderr, "Cannot save the DSP settings!\n");
+				return;
+			}
+
+			fprintf(file, "%i %i %i", dsp->enabled, dsp->latency_ms, dsp->bass_db);
+			for (i = 0; i < DSP_EQ_BANDS; i++)
+				fprintf(file, " %i", dsp->eq_db[i]);
+			fprintf(file, "\n");
+		}
+
+		if (file)
+			fclose(file);
+	}
+}
+
+/* one station per line: frequency in kHz and loudness in tenths of LUFS,
+ * count is the size of the table when reading, and how much was read */
+void handle_loudness(int mode, struct station_loudness *table, int *count)
+{
+	char name[255];
+	FILE *f;
+	int i;
+
+	/* called from the seek thread too, so no shared path or FILE */
+	if (path[0] == '0')
+		return;
+
+	data_file_path("loudness", name, sizeof(name));
+
+	if (mode == MODE_GET) {
+		f = fopen(name, "r");
+
+		if (!f) {
+			*count = 0;
+			return;
+		}
+
+		for (i = 0; i < *count; i++)
+			if (fscanf(f, "%u %d", &table[i].khz, &table[i].lufs10) != 2)
+				break;
+		*count = i;
+	} else if (mode == MODE_SET) {
+		f = fopen(name, "w");
+		trace_setting(TRACE_SET_LOUDNESS, *count, f);
+
+		if (!f) {
+			fprintf(stderr, "Cannot save the station loudness!\n");
+			return;
+		}
+
+		for (i = 0; i < *count; i++)
+			fprintf(f, "%u %d\n", table[i].khz, table[i].lufs10);
+	} else {
+		return;
+	}
+
+	fclose(f);
+}
+
+/* one word, the name of the band plan: wide, europe, americas, japan, oirt */
+void handle_region(int mode, int *region)
+{
+	char name[16];
+	int found;
+
+	if (path[0] != '0') {
+		sprintf(aux_path, "%s/%s", path, "region");
+		if (mode == MODE_GET) {
+			file = fopen(aux_path, "r");
+
+			if (!file)
+				return;
+
+			if (fscanf(file, "%15s", name) == 1) {
+				found = band_find(name);
+				if (found >= 0)
+					*region = found;
+				else
+					fprintf(stderr, "Unknown region %s\n", name);
+			}
+		} else if (mode == MODE_SET) {
+			file = fopen(aux_path, "w");
+			trace_setting(TRACE_SET_REGION, *region, file);
+
+			if (!file) {
+				fprintf(stderr, "Cannot save the region!\n");
+				return;
+			}
+
+			fprintf(file, "%s\n", band_plan(*region)->name);
+		}
+
+		if (file)
+			fclose(file);
+	}
+}
+
+static const char *sched_types[] = { "alarm", "sleep", "record" };
+
+/* Lines like "alarm 2026-10-20 07:00 daily 98.5 30", in local time. The
+ * repeat is once, daily or weekly. This one runs in the event thread too,
+ * so it keeps to its own buffers.
+ */
+void handle_schedule(int mode, struct sched_entry *table, int *count)
+{
+	char name[255], type[16], date[16], clock[16], repeat[16];
+	struct sched_entry *e;
+	struct tm tm;
+	FILE *f;
+	int i, n = 0;
+
+	if (path[0] == '0')
+		return;
+
+	data_file_path("schedule", name, sizeof(name));
+
+	if (mode == MODE_GET) {
+		f = fopen(name, "r");
+
+		if (!f) {
+			*count = 0;
+			return;
+		}
+
+		while (n < *count) {
+			e = &table[n];
+			memset(e, 0, sizeof(*e));
+			memset(&tm, 0, sizeof(tm));
+
+			if (fscanf(f, "%15s %15s %15s %15s %f %d", type, date, clock,
+					repeat, &e->freq, &e->seconds) != 6)
+				break;
+
+			if (sscanf(date, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3 ||
+					sscanf(clock, "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 2)
+				continue;
+
+			tm.tm_year -= 1900;
+			tm.tm_mon--;
+			tm.tm_isdst = -1;
+			e->at = mktime(&tm);
+
+			e->repeat_days = !strcmp(repeat, "daily") ? 1 : !strcmp(repeat, "weekly") ? 7 : 0;
+
+			for (e->type = SCHED_ALARM; e->type <= SCHED_RECORD; e->type++)
+				if (!strcmp(type, sched_types[e->type]))
+					break;
+
+			if (e->type <= SCHED_RECORD)
+				n++;
+		}
+		*count = n;
+	} else if (mode == MODE_SET) {
+		f = fopen(name, "w");
+		trace_setting(TRACE_SET_SCHEDULE, *count, f);
+
+		if (!f) {
+			fprintf(stderr, "Cannot save the schedule!\n");
+			return;
+		}
+
+		for (i = 0; i < *count; i++) {
+			e = &table[i];
+			localtime_r(&e->at, &tm);
+
+			fprintf(f, "%s %04d-%02d-%02d %02d:%02d", sched_types[e->type],
+					tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min);
+			if (tm.tm_sec)
+				fprintf(f, ":%02d", tm.tm_sec);
+			fprintf(f, " %s %.2f %d\n", e->repeat_days == 7 ? "weekly" :
+					e->repeat_days ? "daily" : "once", e->freq, e->seconds);
+		}
+	} else {
+		return;
+	}
+
+	fclose(f);
+}
+
 static void remove_new_line(char *orig)
 {
 	int i;
@@ -162,21 +442,22 @@ static void remove_new_line(char *orig)
 			orig[i] = '\0';
 }
 
-static void write_favradios()
+static void write_favradios(const struct radios *favs)
 {
 	sprintf(aux_path, "%s/%s", path, "favorite_radios");
 	file = fopen(aux_path, "w");
+	trace_setting(TRACE_SET_FAVRADS, favs->num_radios, file);
 
 	if (file) {
 		int i;
 		for (i = 0; i < 5; i++)
-			fprintf(file, "%s\n", favrads.radio[i]);
+			fprintf(file, "%s\n", favs->radio[i]);
 
 		fclose(file);
 	}
 }
 
-void handle_fav_radios(int mode, char *value, int pos)
+void handle_fav_radios(int mode, struct radios *favs, char *value, int pos)
 {
 	if (path[0] != '0') {
 		sprintf(aux_path, "%s/%s", path, "favorite_radios");
@@ -190,25 +471,30 @@ void handle_fav_radios(int mode, char *value, int pos)
 			size_t len;
 			ssize_t read;
 
-			favrads.num_radios = 0;
+			favs->num_radios = 0;
 
-			while ((read = getline(&line, &len, file)) != -1 && favrads.num_radios < 5) {
+			while ((read = getline(&line, &len, file)) != -1 && favs->num_radios < 5) {
 				remove_new_line(line);
-				strncpy(favrads.radio[favrads.num_radios++], line, strlen(line) + 1);
+				strncpy(favs->radio[favs->num_radios++], line, strlen(line) + 1);
 			}
 			fclose(file);
 
 		} else if (mode == FILE_FAVRAD_WRITE) {
-			strcpy(favrads.radio[pos], value);
-			write_favradios();
+			strcpy(favs->radio[pos], value);
+			write_favradios(favs);
 		} else if (mode == FILE_FAVRAD_DELETE) {
-			strcpy(favrads.radio[pos], "0");
-			write_favradios();
-			favrads.num_radios--;
+			strcpy(favs->radio[pos], "0");
+			write_favradios(favs);
+			favs->num_radios--;
 		}
 	}
 }
 
+void data_file_path(const char *name, char *out, int size)
+{
+	snprintf(out, size, "%s/%s", path, name);
+}
+
 /* Set the path global variable */
 int set_home_path()
 {
@@ -30,8 +30,33 @@ void handle_sound_level(int mode, long *volume);
 /* save the last mode, if it was in speakers or headphone */
 void handle_mode(int mode, int *value);
 
+/* enable/disable the audio verification of the seek */
+void handle_seek_verify(int mode, int *value);
+
+/* TCP port of the HTTP stream, 0 when it is disabled */
+void handle_stream_port(int mode, int *port);
+
+/* software audio path settings, see dsp.h */
+struct dsp_settings;
+void handle_dsp(int mode, struct dsp_settings *dsp);
+
+/* loudness learned for each station, see loudness.h */
+struct station_loudness;
+void handle_loudness(int mode, struct station_loudness *table, int *count);
+
+/* alarms, sleep timer and recordings, see sched.h */
+struct sched_entry;
+void handle_schedule(int mode, struct sched_entry *table, int *count);
+
+/* band plan of the region, by its name (see tuner.h) */
+void handle_region(int mode, int *region);
+
+/* full name of a file kept in ~/.radioplayer */
+void data_file_path(const char *name, char *out, int size);
+
 /* handle favorite radios, ir we want to add or maybe remove radio stations */
-void handle_fav_radios(int mode, char *value, int pos);
+struct radios;
+void handle_fav_radios(int mode, struct radios *favs, char *value, int pos);
 
 
 int set_home_path();
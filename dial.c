@@ -0,0 +1,255 @@
+/*
+ * dial.c - Animated tuning dial. A scale scrolls under a fixed needle and
+ *          eases toward the tuned frequency, or follows a seek. Frames come
+ *          from a timerfd at the display refresh; a tick is dropped when
+ *          the previous frame was not drawn yet, and the timer stops when
+ *          the dial is still.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "render.h"
+#include "dial.h"
+#include "events.h"
+#include "radio.h"
+#include "tuner.h"
+
+#define FIRST_MHZ (BAND_MIN_KHZ / 1000)
+#define LAST_MHZ (BAND_MAX_KHZ / 1000)
+
+/* labels of the major ticks, rasterised once */
+static struct text_mask *labels[LAST_MHZ - FIRST_MHZ + 1];
+
+static float pos_khz, target_khz;
+static int placed, seeking;
+
+static int timer = -1;
+static int running;
+static long interval_ms = 1000 / DIAL_FPS;
+static long last_us;
+
+/* set by the event thread, cleared when the frame is drawn */
+static volatile int frame_pending;
+static volatile unsigned long dropped;
+
+static struct {
+	unsigned long frames;
+	unsigned long over_budget;
+	long cpu_ns;
+	long max_ns;
+} stats;
+
+static long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* event thread: ask for a frame, unless one is still waiting */
+static void frame_tick(int fd, void *data)
+{
+	SDL_Event event;
+
+	events_timer_ack(fd);
+
+	if (!__sync_bool_compare_and_swap(&frame_pending, 0, 1)) {
+		dropped++;
+		return;
+	}
+
+	memset(&event, 0, sizeof(event));
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_FRAME;
+	SDL_PushEvent(&event);
+}
+
+static void start(void)
+{
+	if (running || timer < 0)
+		return;
+
+	running = 1;
+	last_us = now_us();
+	events_timer_set(timer, interval_ms, interval_ms);
+}
+
+static void stop(void)
+{
+	running = 0;
+	events_timer_set(timer, 0, 0);
+
+	if (stats.frames)
+		printf("dial: %lu frames, %lu dropped, %lu over budget, cpu avg %ld us max %ld us\n",
+				stats.frames, dropped, stats.over_budget,
+				stats.cpu_ns / stats.frames / 1000, stats.max_ns / 1000);
+
+	memset(&stats, 0, sizeof(stats));
+	dropped = 0;
+}
+
+static void draw(void)
+{
+	SDL_Rect rect = { DIAL_X, DIAL_Y, DIAL_W, DIAL_H };
+	int center = DIAL_X + DIAL_W / 2;
+	int half = DIAL_W / 2 / DIAL_PX_PER_STEP + 1;
+	int step, base = pos_khz / 100;
+	const struct band_plan *plan = band_active();
+
+	render_fill(&rect, UI_BLACK);
+
+	for (step = base - half; step <= base + half; step++) {
+		int khz = step * 100, h = 4;
+		int x = center + lroundf((khz - pos_khz) * DIAL_PX_PER_STEP / 100);
+		SDL_Rect tick;
+
+		/* the tape ends with the band of the region */
+		if (khz < plan->min_khz / 100 * 100 || khz > plan->max_khz)
+			continue;
+		if (x < DIAL_X || x >= DIAL_X + DIAL_W)
+			continue;
+
+		if (khz % 1000 == 0) {
+			const struct text_mask *label = labels[khz / 1000 - FIRST_MHZ];
+
+			h = 10;
+
+			/* labels that don't fit in the dial are left out */
+			if (label && x - label->w / 2 >= DIAL_X &&
+					x + label->w / 2 < DIAL_X + DIAL_W)
+				render_blit_mask(label, x - label->w / 2, DIAL_Y, UI_WHITE);
+		} else if (khz % 500 == 0) {
+			h = 7;
+		}
+
+		tick.x = x;
+		tick.y = DIAL_Y + DIAL_H - h;
+		tick.w = 1;
+		tick.h = h;
+		render_fill(&tick, UI_WHITE);
+	}
+
+	rect.x = center - 1;
+	rect.w = 2;
+	render_fill(&rect, UI_GREEN);
+}
+
+int dial_init(TTF_Font *label_font)
+{
+	char text[4];
+	int mhz;
+
+	for (mhz = FIRST_MHZ; mhz <= LAST_MHZ; mhz++) {
+		sprintf(text, "%d", mhz);
+		labels[mhz - FIRST_MHZ] = render_text_mask(label_font, text);
+	}
+
+	timer = events_timer_new();
+	if (timer < 0 || events_add(timer, 0, frame_tick, NULL) < 0) {
+		fprintf(stderr, "Dial animation disabled\n");
+		timer = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+void dial_set(float freq)
+{
+	target_khz = freq * 1000;
+
+	/* no animation for the first position, or without a timer */
+	if (!placed || timer < 0) {
+		pos_khz = target_khz;
+		placed = 1;
+		draw();
+		return;
+	}
+
+	start();
+}
+
+void dial_seek(int direction)
+{
+	seeking = direction;
+
+	if (direction)
+		start();
+}
+
+void dial_frame(void)
+{
+	struct timespec c0, c1;
+	long now = now_us(), dt = now - last_us, cpu;
+	float probe;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c0);
+	last_us = now;
+
+	/* nobody is looking, jump to the end and wait for the next tune */
+	if (render_suspended()) {
+		pos_khz = target_khz;
+		draw();
+		frame_pending = 0;
+		stop();
+		return;
+	}
+
+	if (seeking) {
+		probe = seek_position() * 1000;
+
+		if (probe > 0) {
+			target_khz = probe;
+		} else {
+			/* we don't know where the seek is, just sweep the band */
+			target_khz = pos_khz + seeking * DIAL_SWEEP_KHZ_S * (dt / 1000000.0f);
+			if (target_khz > band_active()->max_khz)
+				target_khz = band_active()->min_khz;
+			else if (target_khz < band_active()->min_khz)
+				target_khz = band_active()->max_khz;
+			pos_khz = target_khz;
+		}
+	}
+
+	/* ease toward the target, the same way whatever the frame rate */
+	pos_khz += (target_khz - pos_khz) * (1 - expf(-dt / (DIAL_TAU_MS * 1000.0f)));
+	if (fabsf(target_khz - pos_khz) < 2)
+		pos_khz = target_khz;
+
+	draw();
+	render_flush();
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c1);
+	cpu = (c1.tv_sec - c0.tv_sec) * 1000000000L + c1.tv_nsec - c0.tv_nsec;
+
+	stats.frames++;
+	stats.cpu_ns += cpu;
+	if (cpu > stats.max_ns)
+		stats.max_ns = cpu;
+
+	/* too expensive for this device, draw less often */
+	if (cpu > DIAL_BUDGET_US * 1000L && ++stats.over_budget % 4 == 0 && interval_ms < 100) {
+		interval_ms *= 2;
+		events_timer_set(timer, interval_ms, interval_ms);
+	}
+
+	frame_pending = 0;
+
+	if (!seeking && pos_khz == target_khz)
+		stop();
+}
@@ -0,0 +1,38 @@
+/*
+ * dial.h - Animated tuning dial
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* display refresh, the dial never draws faster */
+#define DIAL_FPS 60
+
+/* CPU time one frame may take, the frame rate drops if it is exceeded */
+#define DIAL_BUDGET_US 2000
+
+#define DIAL_X 0
+#define DIAL_Y 66
+#define DIAL_W 296
+#define DIAL_H 30
+
+/* pixels between two 100 kHz ticks */
+#define DIAL_PX_PER_STEP 5
+
+/* time constant of the needle, and the sweep speed while seeking */
+#define DIAL_TAU_MS 80
+#define DIAL_SWEEP_KHZ_S 6000
+
+int dial_init(TTF_Font *label_font);
+
+/* move the needle to freq, the first call places it without animation */
+void dial_set(float freq);
+
+/* follow a seek going up (1) or down (-1), 0 when it is over */
+void dial_seek(int direction);
+
+/* draw one frame, called by the main loop on EVENT_FRAME */
+void dial_frame(void);
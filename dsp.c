@@ -0,0 +1,321 @@
+/*
+ * dsp.c - Software audio path. Line In is taken from the capture thread a
+ *         block at a time, goes through a cascade of biquads (the EQ bands
+ *         and the bass boost) and a look-ahead limiter, and is written to
+ *         the PCM. Everything runs in fixed point: samples are S16 shifted
+ *         up by 8 bits to get room for the boosts, coefficients are Q28,
+ *         and both channels of a frame are filtered side by side.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <alsa/asoundlib.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "capture.h"
+#include "dsp.h"
+
+#define COEF_SHIFT 28
+#define SAMPLE_SHIFT 8
+
+#define EQ_Q 1.0f
+#define BASS_HZ 100.0f
+
+/* limiter release, about 50 ms */
+#define RELEASE_SHIFT 11
+
+#define UNITY (1 << 16)
+
+struct biquad {
+	int32_t b0, b1, b2, a1, a2;
+	int32_t x1[2], x2[2], y1[2], y2[2];
+};
+
+struct limiter {
+	int32_t delay[DSP_LOOKAHEAD][2];
+	unsigned int pos;
+
+	/* smallest gains needed in the look-ahead window, oldest first */
+	int32_t queue_gain[DSP_LOOKAHEAD + 1];
+	unsigned int queue_when[DSP_LOOKAHEAD + 1];
+	unsigned int head, count;
+
+	unsigned int now;
+	int32_t gain;
+};
+
+static const float eq_hz[DSP_EQ_BANDS] = { 60, 250, 1000, 4000, 12000 };
+
+static struct biquad stages[DSP_EQ_BANDS + 1];
+static int num_stages;
+
+static struct limiter limiter;
+
+static snd_pcm_t *pcm;
+static int running;
+
+static struct {
+	unsigned long blocks;
+	unsigned long dropped;
+	long cpu_ns;
+	long max_ns;
+} stats;
+
+/* store a normalised biquad, a0 is folded into the other coefficients */
+static void set_coefs(struct biquad *bq, float b0, float b1, float b2,
+		float a0, float a1, float a2)
+{
+	const float scale = (1 << COEF_SHIFT) / a0;
+
+	memset(bq, 0, sizeof(*bq));
+	bq->b0 = lroundf(b0 * scale);
+	bq->b1 = lroundf(b1 * scale);
+	bq->b2 = lroundf(b2 * scale);
+	bq->a1 = lroundf(a1 * scale);
+	bq->a2 = lroundf(a2 * scale);
+}
+
+/* peaking EQ and low shelf of the Audio EQ Cookbook */
+static void design_peak(struct biquad *bq, float hz, int db)
+{
+	float a = powf(10, db / 40.0f);
+	float w0 = 2 * M_PI * hz / CAPTURE_RATE;
+	float alpha = sinf(w0) / (2 * EQ_Q);
+
+	set_coefs(bq, 1 + alpha * a, -2 * cosf(w0), 1 - alpha * a,
+			1 + alpha / a, -2 * cosf(w0), 1 - alpha / a);
+}
+
+static void design_low_shelf(struct biquad *bq, float hz, int db)
+{
+	float a = powf(10, db / 40.0f);
+	float w0 = 2 * M_PI * hz / CAPTURE_RATE;
+	float alpha = sinf(w0) / 2 * sqrtf(2);
+	float c = cosf(w0), s = 2 * sqrtf(a) * alpha;
+
+	set_coefs(bq, a * ((a + 1) - (a - 1) * c + s),
+			2 * a * ((a - 1) - (a + 1) * c),
+			a * ((a + 1) - (a - 1) * c - s),
+			(a + 1) + (a - 1) * c + s,
+			-2 * ((a - 1) + (a + 1) * c),
+			(a + 1) + (a - 1) * c - s);
+}
+
+static int clamp_db(int db)
+{
+	if (db > DSP_MAX_DB)
+		return DSP_MAX_DB;
+	if (db < -DSP_MAX_DB)
+		return -DSP_MAX_DB;
+	return db;
+}
+
+/* one stage over a whole block, left and right in the same iteration */
+static void biquad_run(struct biquad *bq, int32_t *restrict buf, unsigned int frames)
+{
+	const int64_t b0 = bq->b0, b1 = bq->b1, b2 = bq->b2, a1 = bq->a1, a2 = bq->a2;
+	int32_t x1l = bq->x1[0], x2l = bq->x2[0], y1l = bq->y1[0], y2l = bq->y2[0];
+	int32_t x1r = bq->x1[1], x2r = bq->x2[1], y1r = bq->y1[1], y2r = bq->y2[1];
+	unsigned int i;
+
+	for (i = 0; i < frames; i++) {
+		int32_t xl = buf[2 * i], xr = buf[2 * i + 1];
+		int32_t yl = (b0 * xl + b1 * x1l + b2 * x2l - a1 * y1l - a2 * y2l) >> COEF_SHIFT;
+		int32_t yr = (b0 * xr + b1 * x1r + b2 * x2r - a1 * y1r - a2 * y2r) >> COEF_SHIFT;
+
+		x2l = x1l; x1l = xl; y2l = y1l; y1l = yl;
+		x2r = x1r; x1r = xr; y2r = y1r; y1r = yr;
+
+		buf[2 * i] = yl;
+		buf[2 * i + 1] = yr;
+	}
+
+	bq->x1[0] = x1l; bq->x2[0] = x2l; bq->y1[0] = y1l; bq->y2[0] = y2l;
+	bq->x1[1] = x1r; bq->x2[1] = x2r; bq->y1[1] = y1r; bq->y2[1] = y2r;
+}
+
+static int16_t saturate(int32_t v)
+{
+	v >>= SAMPLE_SHIFT;
+	if (v > 32767)
+		return 32767;
+	if (v < -32768)
+		return -32768;
+	return v;
+}
+
+/* Stereo linked limiter. The gain needed by each frame enters a window as
+ * long as the delay line, and the gain slides down so it reaches what the
+ * loudest frame needs right when that frame comes out of the delay.
+ */
+static void limiter_run(struct limiter *lim, const int32_t *in, int16_t *out,
+		unsigned int frames)
+{
+	const int32_t ceiling = DSP_CEILING << SAMPLE_SHIFT;
+	const unsigned int size = DSP_LOOKAHEAD + 1;
+	unsigned int i;
+
+	for (i = 0; i < frames; i++) {
+		int32_t l = in[2 * i], r = in[2 * i + 1];
+		int32_t peak = abs(l) > abs(r) ? abs(l) : abs(r);
+		int32_t need = UNITY, target, *slot = lim->delay[lim->pos];
+		unsigned int first;
+
+		if (peak > ceiling)
+			need = ((int64_t)ceiling << 16) / peak;
+
+		/* drop the gains that can't be the minimum anymore */
+		while (lim->count && lim->queue_gain[(lim->head + lim->count - 1) % size] >= need)
+			lim->count--;
+		lim->queue_gain[(lim->head + lim->count) % size] = need;
+		lim->queue_when[(lim->head + lim->count) % size] = lim->now;
+		lim->count++;
+
+		if (lim->now - lim->queue_when[lim->head] > DSP_LOOKAHEAD) {
+			lim->head = (lim->head + 1) % size;
+			lim->count--;
+		}
+
+		target = lim->queue_gain[lim->head];
+		first = lim->queue_when[lim->head];
+
+		if (target < lim->gain) {
+			/* frames left before the one needing target is played */
+			unsigned int left = first + DSP_LOOKAHEAD - lim->now + 1;
+
+			lim->gain -= (lim->gain - target + left - 1) / left;
+		} else {
+			lim->gain += ((target - lim->gain) >> RELEASE_SHIFT) + (target > lim->gain);
+		}
+
+		out[2 * i] = saturate(((int64_t)slot[0] * lim->gain) >> 16);
+		out[2 * i + 1] = saturate(((int64_t)slot[1] * lim->gain) >> 16);
+
+		slot[0] = l;
+		slot[1] = r;
+		lim->pos = (lim->pos + 1) % DSP_LOOKAHEAD;
+		lim->now++;
+	}
+}
+
+/* capture thread */
+static void process(const short *frames, unsigned int count, void *data)
+{
+	static int32_t buf[CAPTURE_PERIOD * CAPTURE_CHANNELS];
+	static int16_t out[CAPTURE_PERIOD * CAPTURE_CHANNELS];
+	struct timespec t0, t1;
+	snd_pcm_sframes_t n;
+	unsigned int i;
+	long ns;
+	int s;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+
+	for (i = 0; i < count * CAPTURE_CHANNELS; i++)
+		buf[i] = frames[i] << SAMPLE_SHIFT;
+
+	for (s = 0; s < num_stages; s++)
+		biquad_run(&stages[s], buf, count);
+
+	limiter_run(&limiter, buf, out, count);
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+	ns = (t1.tv_sec - t0.tv_sec) * 1000000000L + t1.tv_nsec - t0.tv_nsec;
+
+	stats.cpu_ns += ns;
+	if (ns > stats.max_ns)
+		stats.max_ns = ns;
+
+	n = snd_pcm_writei(pcm, out, count);
+	if (n == -EAGAIN)
+		stats.dropped++;
+	else if (n < 0)
+		snd_pcm_recover(pcm, n, 1);
+
+	if (++stats.blocks == DSP_STATS_BLOCKS) {
+		printf("dsp: %d stages, block avg %ld us max %ld us (%ld%% of %d ms), %lu dropped\n",
+				num_stages, stats.cpu_ns / stats.blocks / 1000, stats.max_ns / 1000,
+				stats.cpu_ns / stats.blocks / (CAPTURE_PERIOD * 10000000L / CAPTURE_RATE),
+				CAPTURE_PERIOD * 1000 / CAPTURE_RATE, stats.dropped);
+		memset(&stats, 0, sizeof(stats));
+	}
+}
+
+int dsp_start(const struct dsp_settings *settings)
+{
+	int i, err, latency_ms = settings->latency_ms > 0 ? settings->latency_ms : DSP_LATENCY_MS;
+
+	/* the capture block and the look-ahead come first, the PCM gets the rest */
+	long playback_us = latency_ms * 1000L - CAPTURE_PERIOD * 1000000L / CAPTURE_RATE -
+		DSP_LOOKAHEAD * 1000000L / CAPTURE_RATE;
+
+	if (running)
+		return 0;
+
+	if (playback_us < 2000) {
+		fprintf(stderr, "dsp: a latency of %d ms is too low\n", latency_ms);
+		return -1;
+	}
+
+	num_stages = 0;
+	if (settings->bass_db)
+		design_low_shelf(&stages[num_stages++], BASS_HZ, clamp_db(settings->bass_db));
+
+	/* flat bands cost nothing */
+	for (i = 0; i < DSP_EQ_BANDS; i++)
+		if (settings->eq_db[i])
+			design_peak(&stages[num_stages++], eq_hz[i], clamp_db(settings->eq_db[i]));
+
+	memset(&limiter, 0, sizeof(limiter));
+	limiter.gain = UNITY;
+	memset(&stats, 0, sizeof(stats));
+
+	err = snd_pcm_open(&pcm, DSP_PLAYBACK_DEVICE, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+	if (err < 0) {
+		fprintf(stderr, "dsp: cannot open %s: %s\n", DSP_PLAYBACK_DEVICE, snd_strerror(err));
+		return -1;
+	}
+
+	err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED,
+			CAPTURE_CHANNELS, CAPTURE_RATE, 1, playback_us);
+	if (err < 0 || capture_start() < 0) {
+		fprintf(stderr, "dsp: cannot set up the audio path\n");
+		snd_pcm_close(pcm);
+		return -1;
+	}
+
+	capture_add_tap(process, NULL);
+	running = 1;
+
+	printf("dsp: %d stages, %d ms of added latency at most\n", num_stages, latency_ms);
+	return 0;
+}
+
+void dsp_stop(void)
+{
+	if (!running)
+		return;
+
+	capture_remove_tap(process, NULL);
+	capture_stop();
+
+	snd_pcm_drop(pcm);
+	snd_pcm_close(pcm);
+	running = 0;
+}
+
+int dsp_running(void)
+{
+	return running;
+}
@@ -0,0 +1,43 @@
+/*
+ * dsp.h - Optional software audio path with an EQ, bass boost and limiter
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define DSP_PLAYBACK_DEVICE "default"
+
+#define DSP_EQ_BANDS 5
+
+/* gains are clamped to +-DSP_MAX_DB */
+#define DSP_MAX_DB 12
+
+/* default bound of the delay the DSP path adds to the radio */
+#define DSP_LATENCY_MS 20
+
+/* limiter look-ahead, 2 ms, and its ceiling, -0.2 dBFS */
+#define DSP_LOOKAHEAD 88
+#define DSP_CEILING 32000
+
+/* print the CPU load every this many blocks, 5 s */
+#define DSP_STATS_BLOCKS 500
+
+/* what is kept in ~/.radioplayer/dsp */
+struct dsp_settings {
+	int enabled;
+	int latency_ms;
+	int bass_db;                /* low shelf at 100 Hz, 0 turns it off */
+	int eq_db[DSP_EQ_BANDS];    /* 60 Hz, 250 Hz, 1 kHz, 4 kHz, 12 kHz */
+};
+
+/* Capture Line In, run it through the filters and play it to the PCM.
+ * The mixer has to route the PCM instead of the bypass, see
+ * mixer_software_path(). Returns 0 on success.
+ */
+int dsp_start(const struct dsp_settings *settings);
+void dsp_stop(void);
+
+int dsp_running(void);
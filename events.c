@@ -0,0 +1,193 @@
+/*
+ * events.c - Event thread. SDL 1.2 can't wait on anything but its own
+ *            events, so every fd based source of work (timers, mixer,
+ *            sockets) is watched from here and its handler runs in this
+ *            thread. Handlers that touch the screen push an SDL event.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "events.h"
+
+struct watch {
+	int fd;
+	event_handler handler;
+	void *data;
+};
+
+static struct watch watches[EVENTS_MAX_FDS];
+
+/* recursive, a handler may remove its own fd */
+static pthread_mutex_t lock;
+static pthread_t thread;
+
+static int epfd = -1;
+static int stopfd = -1;
+static volatile int running;
+
+static void *events_thread(void *arg)
+{
+	struct epoll_event ev[EVENTS_MAX_FDS];
+	int i, n;
+
+	while (running) {
+		n = epoll_wait(epfd, ev, EVENTS_MAX_FDS, -1);
+
+		for (i = 0; i < n; i++) {
+			struct watch *w = ev[i].data.ptr;
+
+			if (!w)
+				continue;
+
+			pthread_mutex_lock(&lock);
+			if (w->handler)
+				w->handler(w->fd, w->data);
+			pthread_mutex_unlock(&lock);
+		}
+	}
+
+	return NULL;
+}
+
+int events_start(void)
+{
+	struct epoll_event ev;
+	pthread_mutexattr_t attr;
+
+	if (running)
+		return 0;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if (epfd < 0 || stopfd < 0) {
+		perror("events");
+		return -1;
+	}
+
+	/* the stop fd has no watch, it only wakes the thread up */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, stopfd, &ev);
+
+	running = 1;
+	if (pthread_create(&thread, NULL, events_thread, NULL)) {
+		fprintf(stderr, "Cannot start the event thread\n");
+		running = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void events_stop(void)
+{
+	uint64_t one = 1;
+
+	if (!running)
+		return;
+
+	running = 0;
+	if (write(stopfd, &one, sizeof(one)) < 0)
+		perror("events: stop");
+	pthread_join(thread, NULL);
+
+	close(stopfd);
+	close(epfd);
+}
+
+int events_add(int fd, unsigned int events, event_handler handler, void *data)
+{
+	struct epoll_event ev;
+	int i, ret = -1;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < EVENTS_MAX_FDS; i++) {
+		if (watches[i].handler)
+			continue;
+
+		watches[i].fd = fd;
+		watches[i].handler = handler;
+		watches[i].data = data;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events ? events : EPOLLIN;
+		ev.data.ptr = &watches[i];
+
+		ret = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+		if (ret < 0) {
+			perror("events: add");
+			watches[i].handler = NULL;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+void events_remove(int fd)
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < EVENTS_MAX_FDS; i++) {
+		if (watches[i].handler && watches[i].fd == fd) {
+			epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+			watches[i].handler = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+int events_timer_new(void)
+{
+	return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+void events_timer_set(int fd, long value_ms, long period_ms)
+{
+	struct itimerspec its;
+
+	its.it_value.tv_sec = value_ms / 1000;
+	its.it_value.tv_nsec = (value_ms % 1000) * 1000000L;
+	its.it_interval.tv_sec = period_ms / 1000;
+	its.it_interval.tv_nsec = (period_ms % 1000) * 1000000L;
+
+	timerfd_settime(fd, 0, &its, NULL);
+}
+
+unsigned long events_timer_ack(int fd)
+{
+	uint64_t expirations = 0;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0)
+		return 0;
+
+	return expirations;
+}
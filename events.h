@@ -0,0 +1,33 @@
+/*
+ * events.h - Event thread that waits on file descriptors (timerfds, mixer
+ *            poll descriptors...) while the main thread waits on SDL
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* the timers, the mixer poll descriptors and the stream socket take up to
+ * EVENTS_RESERVED_FDS, the rest is for the stream clients
+ */
+#define EVENTS_RESERVED_FDS 16
+#define EVENTS_MAX_FDS (EVENTS_RESERVED_FDS + 16)
+
+/* called from the event thread when fd is readable */
+typedef void (*event_handler)(int fd, void *data);
+
+int events_start(void);
+void events_stop(void);
+
+/* watch fd for input (events is EPOLLIN when 0), returns 0 on success */
+int events_add(int fd, unsigned int events, event_handler handler, void *data);
+void events_remove(int fd);
+
+/* timerfd helpers, times in ms, period 0 means one shot, value 0 disarms */
+int events_timer_new(void);
+void events_timer_set(int fd, long value_ms, long period_ms);
+
+/* clear the expirations of a timerfd, returns how many there were */
+unsigned long events_timer_ack(int fd);
@@ -0,0 +1,97 @@
+/*
+ * fft.c - In place radix-2 FFT of a fixed size. The bit reversal is a
+ *         table of swaps and the twiddles of each stage are read with a
+ *         constant stride, so the butterflies are plain loops the compiler
+ *         can unroll.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "fft.h"
+
+static float twiddle_re[FFT_SIZE / 2];
+static float twiddle_im[FFT_SIZE / 2];
+
+/* pairs of indexes swapped by the bit reversal */
+static uint16_t swaps[FFT_SIZE][2];
+static int num_swaps;
+
+/* the seek and the fingerprint threads may both get here first */
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void make_tables(void)
+{
+	int i, j;
+
+	for (i = 0; i < FFT_SIZE / 2; i++) {
+		twiddle_re[i] = cosf(2 * M_PI * i / FFT_SIZE);
+		twiddle_im[i] = -sinf(2 * M_PI * i / FFT_SIZE);
+	}
+
+	for (i = 1, j = 0; i < FFT_SIZE; i++) {
+		int bit = FFT_SIZE >> 1;
+
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+
+		if (i < j) {
+			swaps[num_swaps][0] = i;
+			swaps[num_swaps][1] = j;
+			num_swaps++;
+		}
+	}
+}
+
+void fft_init(void)
+{
+	pthread_once(&tables_once, make_tables);
+}
+
+void fft(float *re, float *im)
+{
+	int i, k, len;
+
+	for (i = 0; i < num_swaps; i++) {
+		int a = swaps[i][0], b = swaps[i][1];
+		float t = re[a];
+
+		re[a] = re[b];
+		re[b] = t;
+		t = im[a];
+		im[a] = im[b];
+		im[b] = t;
+	}
+
+	for (len = 2; len <= FFT_SIZE; len <<= 1) {
+		int half = len >> 1, step = FFT_SIZE / len;
+
+		for (i = 0; i < FFT_SIZE; i += len) {
+			for (k = 0; k < half; k++) {
+				float wr = twiddle_re[k * step], wi = twiddle_im[k * step];
+				float *ar = &re[i + k], *ai = &im[i + k];
+				float *br = &re[i + k + half], *bi = &im[i + k + half];
+				float tr = *br * wr - *bi * wi;
+				float ti = *br * wi + *bi * wr;
+
+				*br = *ar - tr;
+				*bi = *ai - ti;
+				*ar += tr;
+				*ai += ti;
+			}
+		}
+	}
+}
@@ -0,0 +1,17 @@
+/*
+ * fft.h - FFT shared by the audio analysis modules
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define FFT_SIZE 1024
+
+/* build the tables, safe to call more than once and from any thread */
+void fft_init(void);
+
+/* in place radix-2 FFT of FFT_SIZE points */
+void fft(float *re, float *im);
@@ -0,0 +1,376 @@
+/*
+ * fingerprint.c - Name the song playing. The capture tap only downmixes
+ *                 into a ring; a low priority thread hashes it with
+ *                 fphash.c and looks the hashes up in the index, which is
+ *                 mapped and never read in full. A song is named when
+ *                 enough hashes of it agree on the same time offset within
+ *                 a window. Memory is fixed, and when the thread can't keep
+ *                 up the audio is dropped instead of queued.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <SDL.h>
+
+#include "capture.h"
+#include "data.h"
+#include "fingerprint.h"
+#include "fphash.h"
+#include "radio.h"
+
+/* audio handed to the hasher at once, one hop */
+#define CHUNK (FP_HOP * FP_DECIMATE)
+
+#define LOG2_VOTE_SLOTS 12
+
+#if (1 << LOG2_VOTE_SLOTS) != FINGERPRINT_VOTE_SLOTS
+#error "the vote table is a power of two"
+#endif
+
+/* the index, mapped read only */
+static void *map;
+static size_t map_size;
+static const struct fp_index_header *header;
+static const uint32_t *starts;
+static const struct fp_entry *entries;
+static const char *titles;
+
+/* filled by the capture thread, emptied by the hashing thread */
+static short ring[FINGERPRINT_RING];
+static unsigned int head, tail;
+static unsigned long dropped;
+
+/* bumped by every retune, the thread starts over when it sees it */
+static unsigned int generation;
+static char now_playing[FP_TITLE_LEN];
+static struct timespec tuned_at;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+static volatile int running;
+
+/* hashing thread only */
+static struct fp_hasher hasher;
+static struct vote {
+	uint32_t key;
+	uint32_t count;
+} votes[FINGERPRINT_VOTE_SLOTS];
+static unsigned int window_start, window_hashes, misses;
+static long window_ns;
+
+static long ms_since(const struct timespec *t0)
+{
+	struct timespec t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) * 1000 + (t1.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+/* The file is trusted for nothing: every size is checked against what is
+ * left of the mapping, without overflow on a 32 bit size_t, and the bucket
+ * starts once here so that lookups stay inside the entries.
+ */
+static int check_index(void)
+{
+	size_t left = map_size - sizeof(*header), buckets;
+	uint32_t i;
+
+	if (memcmp(header->magic, FP_INDEX_MAGIC, 8) || header->log2_buckets < 1 ||
+			header->log2_buckets > 28)
+		return -1;
+
+	buckets = (size_t)1 << header->log2_buckets;
+	if (left / sizeof(uint32_t) < buckets + 1)
+		return -1;
+	left -= (buckets + 1) * sizeof(uint32_t);
+
+	if (left / sizeof(struct fp_entry) < header->num_entries)
+		return -1;
+	left -= (size_t)header->num_entries * sizeof(struct fp_entry);
+
+	if (left / FP_TITLE_LEN < header->num_tracks ||
+			left != (size_t)header->num_tracks * FP_TITLE_LEN)
+		return -1;
+
+	starts = (const uint32_t *)(header + 1);
+	for (i = 0; i < buckets; i++)
+		if (starts[i] > starts[i + 1])
+			return -1;
+
+	return starts[buckets] == header->num_entries ? 0 : -1;
+}
+
+static int map_index(const char *name)
+{
+	struct stat st;
+	int fd = open(name, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*header)) {
+		close(fd);
+		return -1;
+	}
+
+	map_size = st.st_size;
+	map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	header = map;
+	if (check_index() < 0) {
+		fprintf(stderr, "%s is not a fingerprint index\n", name);
+		munmap(map, map_size);
+		return -1;
+	}
+
+	entries = (const struct fp_entry *)(starts + (1u << header->log2_buckets) + 1);
+	titles = (const char *)(entries + header->num_entries);
+
+	/* lookups jump all over the file */
+	madvise(map, map_size, MADV_RANDOM);
+	return 0;
+}
+
+static void vote(uint32_t track, uint32_t offset)
+{
+	uint32_t key = track << 16 | (offset & 0xffff);
+	uint32_t slot = (key * 2654435761u) >> (32 - LOG2_VOTE_SLOTS);
+	int probe;
+
+	/* a full neighbourhood loses the vote, the table never grows */
+	for (probe = 0; probe < 8; probe++) {
+		struct vote *v = &votes[(slot + probe) % FINGERPRINT_VOTE_SLOTS];
+
+		if (!v->count) {
+			v->key = key;
+			v->count = 1;
+			return;
+		}
+		if (v->key == key) {
+			v->count++;
+			return;
+		}
+	}
+}
+
+static void lookup(uint32_t hash, uint32_t time, void *data)
+{
+	uint32_t b = fp_bucket(hash, header->log2_buckets);
+	uint32_t i, end = starts[b + 1];
+	int hits = 0;
+
+	for (i = starts[b]; i < end && hits < FINGERPRINT_MAX_HITS; i++) {
+		if (entries[i].hash != hash || entries[i].track >= header->num_tracks)
+			continue;
+
+		vote(entries[i].track, entries[i].time - time);
+		hits++;
+	}
+
+	window_hashes++;
+}
+
+/* called with the lock held */
+static void publish(const char *title, unsigned int seen)
+{
+	SDL_Event event;
+
+	if (seen != generation || !strcmp(now_playing, title))
+		return;
+
+	snprintf(now_playing, sizeof(now_playing), "%s", title);
+
+	memset(&event, 0, sizeof(event));
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_NOW_PLAYING;
+	SDL_PushEvent(&event);
+}
+
+/* the window is over: name the song with the most votes, if any */
+static void decide(unsigned int seen)
+{
+	const struct vote *best = NULL;
+	const char *title = NULL, *found;
+	char name[FP_TITLE_LEN];
+	int i;
+
+	for (i = 0; i < FINGERPRINT_VOTE_SLOTS; i++)
+		if (votes[i].count && (!best || votes[i].count > best->count))
+			best = &votes[i];
+
+	if (best && best->count >= FINGERPRINT_MIN_VOTES) {
+		/* a title that fills its slot has no NUL */
+		found = titles + (size_t)(best->key >> 16) * FP_TITLE_LEN;
+		snprintf(name, sizeof(name), "%.*s", (int)strnlen(found, FP_TITLE_LEN), found);
+		title = name;
+		misses = 0;
+	} else if (++misses >= FINGERPRINT_FORGET) {
+		title = "";
+	}
+
+	pthread_mutex_lock(&lock);
+	printf("fingerprint: %s, %u votes of %u hashes, %ld ms after the tune, "
+			"%ld ms cpu for %d ms of audio, %lu dropped\n",
+			title && *title ? title : "no match", best ? best->count : 0,
+			window_hashes, ms_since(&tuned_at), window_ns / 1000000,
+			FINGERPRINT_WINDOW * FP_HOP * FP_DECIMATE * 1000 / FP_INPUT_RATE, dropped);
+	if (title)
+		publish(title, seen);
+	pthread_mutex_unlock(&lock);
+
+	memset(votes, 0, sizeof(votes));
+	window_start = hasher.frame;
+	window_hashes = 0;
+	window_ns = 0;
+}
+
+static void *fingerprint_thread(void *arg)
+{
+	static short chunk[CHUNK];
+	unsigned int i, seen = generation - 1;
+	struct timespec t0, t1;
+
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), FINGERPRINT_NICE);
+
+	pthread_mutex_lock(&lock);
+	while (running) {
+		if (seen != generation) {
+			seen = generation;
+			tail = head;
+			fp_init(&hasher);
+			memset(votes, 0, sizeof(votes));
+			window_start = window_hashes = misses = 0;
+			window_ns = 0;
+		}
+
+		if (head - tail < CHUNK) {
+			pthread_cond_wait(&ready, &lock);
+			continue;
+		}
+
+		for (i = 0; i < CHUNK; i++)
+			chunk[i] = ring[(tail + i) % FINGERPRINT_RING];
+		tail += CHUNK;
+		pthread_mutex_unlock(&lock);
+
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+		fp_feed(&hasher, chunk, CHUNK, lookup, NULL);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+		window_ns += (t1.tv_sec - t0.tv_sec) * 1000000000L + t1.tv_nsec - t0.tv_nsec;
+
+		if (hasher.frame - window_start >= FINGERPRINT_WINDOW)
+			decide(seen);
+
+		pthread_mutex_lock(&lock);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+/* capture thread */
+static void fingerprint_tap(const short *frames, unsigned int count, void *data)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&lock);
+
+	if (head - tail + count > FINGERPRINT_RING) {
+		dropped += count;
+	} else {
+		for (i = 0; i < count; i++)
+			ring[(head + i) % FINGERPRINT_RING] = (frames[2 * i] + frames[2 * i + 1]) / 2;
+		head += count;
+
+		if (head - tail >= CHUNK)
+			pthread_cond_signal(&ready);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+int fingerprint_start(void)
+{
+	char name[255];
+
+	data_file_path(FINGERPRINT_INDEX, name, sizeof(name));
+	if (map_index(name) < 0)
+		return -1;
+
+	printf("fingerprint: %u songs, %u hashes\n", header->num_tracks, header->num_entries);
+
+	if (capture_start() < 0) {
+		munmap(map, map_size);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &tuned_at);
+
+	running = 1;
+	if (pthread_create(&thread, NULL, fingerprint_thread, NULL)) {
+		running = 0;
+		capture_stop();
+		munmap(map, map_size);
+		return -1;
+	}
+
+	capture_add_tap(fingerprint_tap, NULL);
+	return 0;
+}
+
+void fingerprint_stop(void)
+{
+	if (!running)
+		return;
+
+	capture_remove_tap(fingerprint_tap, NULL);
+	capture_stop();
+
+	pthread_mutex_lock(&lock);
+	running = 0;
+	pthread_cond_signal(&ready);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+
+	munmap(map, map_size);
+}
+
+void fingerprint_retune(void)
+{
+	pthread_mutex_lock(&lock);
+	generation++;
+	now_playing[0] = '\0';
+	clock_gettime(CLOCK_MONOTONIC, &tuned_at);
+	pthread_cond_signal(&ready);
+	pthread_mutex_unlock(&lock);
+}
+
+void fingerprint_title(char *title, int size)
+{
+	pthread_mutex_lock(&lock);
+	snprintf(title, size, "%s", now_playing);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,44 @@
+/*
+ * fingerprint.h - Name the song playing from a local fingerprint index
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* built by tools/fpindex, in ~/.radioplayer */
+#define FINGERPRINT_INDEX "fingerprints.idx"
+
+/* captured audio waiting for the hashing thread, mono, ~1.5 s */
+#define FINGERPRINT_RING (1 << 16)
+
+/* hashes are matched in windows of this many frames, ~5 s */
+#define FINGERPRINT_WINDOW 108
+
+/* votes of one song at one time offset needed to name it */
+#define FINGERPRINT_MIN_VOTES 12
+
+/* the song is forgotten after this many windows without a match */
+#define FINGERPRINT_FORGET 3
+
+/* index entries looked at for one hash, and size of the vote table */
+#define FINGERPRINT_MAX_HITS 64
+#define FINGERPRINT_VOTE_SLOTS 4096
+
+/* the hashing thread gives way to everything else */
+#define FINGERPRINT_NICE 10
+
+/* Map the index and start listening. Returns -1, and costs nothing, when
+ * there is no index.
+ */
+int fingerprint_start(void);
+void fingerprint_stop(void);
+
+/* the station changed, forget what was heard */
+void fingerprint_retune(void);
+
+/* the song playing, empty when unknown; EVENT_NOW_PLAYING tells when it
+ * changes */
+void fingerprint_title(char *title, int size);
@@ -0,0 +1,156 @@
+/*
+ * fphash.c - Landmark audio fingerprints. The audio is low passed and
+ *            decimated to 11 kHz, and every hop the strongest peak of each
+ *            band of the spectrum is kept if it stands out of its frame.
+ *            Each peak is then paired with the peaks of the next frames,
+ *            and the two frequencies with their distance in time make a
+ *            hash. The same code builds the index offline and hashes the
+ *            radio, so the hashes always agree.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "fft.h"
+#include "fphash.h"
+
+#if FFT_SIZE != 2 * FP_HOP
+#error "the FFT window is two hops"
+#endif
+
+static float window[FFT_SIZE];
+static float fir[FP_FIR_TAPS];
+static int band_edge[FP_BANDS + 1];
+static int tables_ready;
+
+static void init_tables(void)
+{
+	float cut = 5000.0f / FP_INPUT_RATE, sum = 0;
+	int i;
+
+	for (i = 0; i < FFT_SIZE; i++)
+		window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / FFT_SIZE);
+
+	/* windowed sinc, normalised to unity gain */
+	for (i = 0; i < FP_FIR_TAPS; i++) {
+		float x = i - (FP_FIR_TAPS - 1) / 2.0f;
+		float w = 0.54f - 0.46f * cosf(2 * M_PI * i / (FP_FIR_TAPS - 1));
+
+		fir[i] = w * (x ? sinf(2 * M_PI * cut * x) / (M_PI * x) : 2 * cut);
+		sum += fir[i];
+	}
+	for (i = 0; i < FP_FIR_TAPS; i++)
+		fir[i] /= sum;
+
+	for (i = 0; i <= FP_BANDS; i++)
+		band_edge[i] = lroundf(FP_MIN_BIN * powf((float)FP_MAX_BIN / FP_MIN_BIN,
+					(float)i / FP_BANDS));
+
+	fft_init();
+	tables_ready = 1;
+}
+
+void fp_init(struct fp_hasher *h)
+{
+	if (!tables_ready)
+		init_tables();
+
+	memset(h, 0, sizeof(*h));
+}
+
+/* the window is full: find its peaks and pair them with the older ones */
+static void analyse(struct fp_hasher *h, fp_emit emit, void *data)
+{
+	/* one hasher runs at a time, in the player and in the tool */
+	static float re[FFT_SIZE], im[FFT_SIZE];
+	float db[FP_MAX_BIN + 2], mean = 0;
+	unsigned int slot = h->frame % (FP_MAX_DT + 1);
+	struct fp_peak *cur = h->peaks[slot];
+	int i, b, dt, n = 0;
+
+	for (i = 0; i < FFT_SIZE; i++) {
+		re[i] = h->samples[i] * window[i];
+		im[i] = 0;
+	}
+
+	fft(re, im);
+
+	for (i = FP_MIN_BIN - 1; i <= FP_MAX_BIN + 1; i++)
+		db[i] = 10 * log10f(re[i] * re[i] + im[i] * im[i] + 1e-3f);
+	for (i = FP_MIN_BIN; i < FP_MAX_BIN; i++)
+		mean += db[i];
+	mean /= FP_MAX_BIN - FP_MIN_BIN;
+
+	for (b = 0; b < FP_BANDS; b++) {
+		int at = band_edge[b];
+
+		for (i = band_edge[b] + 1; i < band_edge[b + 1]; i++)
+			if (db[i] > db[at])
+				at = i;
+
+		/* a real maximum, not the edge of a bigger one in the next band */
+		if (db[at] > mean + FP_PEAK_DB && db[at] >= db[at - 1] && db[at] >= db[at + 1]) {
+			cur[n].bin = at;
+			cur[n].targets = 0;
+			n++;
+		}
+	}
+	h->num_peaks[slot] = n;
+
+	for (dt = 1; dt <= FP_MAX_DT && dt <= h->frame; dt++) {
+		unsigned int anchor_slot = (h->frame - dt) % (FP_MAX_DT + 1);
+		struct fp_peak *anchors = h->peaks[anchor_slot];
+
+		for (b = 0; b < h->num_peaks[anchor_slot]; b++) {
+			for (i = 0; i < n && anchors[b].targets < FP_FAN_OUT; i++) {
+				emit((uint32_t)anchors[b].bin << 15 | cur[i].bin << 6 | dt,
+						h->frame - dt, data);
+				anchors[b].targets++;
+			}
+		}
+	}
+
+	h->frame++;
+}
+
+void fp_feed(struct fp_hasher *h, const short *samples, unsigned int count,
+		fp_emit emit, void *data)
+{
+	unsigned int i;
+	int t;
+
+	for (i = 0; i < count; i++) {
+		float acc = 0;
+
+		h->history[h->pos] = samples[i];
+		h->pos = (h->pos + 1) % FP_FIR_TAPS;
+
+		/* the low pass only runs for the samples that are kept */
+		if (++h->phase < FP_DECIMATE)
+			continue;
+		h->phase = 0;
+
+		for (t = 0; t < FP_FIR_TAPS; t++)
+			acc += fir[t] * h->history[(h->pos + t) % FP_FIR_TAPS];
+
+		h->samples[h->fill++] = acc;
+		if (h->fill < 2 * FP_HOP)
+			continue;
+
+		analyse(h, emit, data);
+
+		memmove(h->samples, h->samples + FP_HOP, FP_HOP * sizeof(float));
+		h->fill = FP_HOP;
+	}
+}
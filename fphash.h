@@ -0,0 +1,90 @@
+/*
+ * fphash.h - Audio fingerprints, shared by the player and tools/fpindex
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdint.h>
+
+/* 44.1 kHz mono in, analysed at a quarter of it */
+#define FP_INPUT_RATE 44100
+#define FP_DECIMATE 4
+
+/* low pass in front of the decimation, cut at 5 kHz */
+#define FP_FIR_TAPS 32
+
+/* one spectrum every FP_HOP analysed samples, ~46 ms */
+#define FP_HOP 512
+
+/* peaks are looked for from ~300 Hz to ~5 kHz */
+#define FP_MIN_BIN 28
+#define FP_MAX_BIN 464
+
+/* at most one peak per band and frame, bands are log spaced */
+#define FP_BANDS 6
+
+/* a peak stands this much above the mean of its frame, in dB */
+#define FP_PEAK_DB 10.0f
+
+/* an anchor peak is paired with the next FP_FAN_OUT peaks found up to
+ * FP_MAX_DT frames later */
+#define FP_MAX_DT 32
+#define FP_FAN_OUT 4
+
+/* the index file, see tools/fpindex.c */
+#define FP_INDEX_MAGIC "RADIOFP1"
+#define FP_TITLE_LEN 64
+
+struct fp_index_header {
+	char magic[8];
+	uint32_t log2_buckets;
+	uint32_t num_entries;
+	uint32_t num_tracks;
+	uint32_t reserved;
+	/* then (1 << log2_buckets) + 1 uint32_t, where each bucket starts,
+	 * num_entries struct fp_entry sorted by bucket,
+	 * and num_tracks titles of FP_TITLE_LEN bytes */
+};
+
+struct fp_entry {
+	uint32_t hash;
+	uint16_t track;
+	uint16_t time;      /* frame of the anchor peak */
+};
+
+struct fp_peak {
+	uint16_t bin;
+	uint16_t targets;   /* pairs made with it so far */
+};
+
+/* state of the hashing of one stream */
+struct fp_hasher {
+	float history[FP_FIR_TAPS];  /* input of the low pass */
+	unsigned int pos, phase;
+	float samples[2 * FP_HOP];   /* the last FFT window, two hops */
+	unsigned int fill;
+	unsigned int frame;
+
+	/* peaks of the frame being paired and of the FP_MAX_DT before it */
+	struct fp_peak peaks[FP_MAX_DT + 1][FP_BANDS];
+	int num_peaks[FP_MAX_DT + 1];
+};
+
+/* called with each hash, time is the frame of its anchor */
+typedef void (*fp_emit)(uint32_t hash, uint32_t time, void *data);
+
+void fp_init(struct fp_hasher *h);
+
+/* hash count samples of FP_INPUT_RATE mono audio, hashes go to emit */
+void fp_feed(struct fp_hasher *h, const short *samples, unsigned int count,
+		fp_emit emit, void *data);
+
+/* bucket of a hash in an index of 1 << log2_buckets buckets */
+static inline uint32_t fp_bucket(uint32_t hash, uint32_t log2_buckets)
+{
+	return (hash * 2654435761u) >> (32 - log2_buckets);
+}
@@ -0,0 +1,332 @@
+/*
+ * loudness.c - Per station loudness. Line In goes through the K-weighting
+ *              filter of ITU-R BS.1770, the mean square is taken over
+ *              400 ms blocks and the blocks land in a histogram, so the
+ *              integrated loudness with the EBU R128 gates is known at any
+ *              time with constant memory. Each station is remembered by
+ *              frequency and the volume is corrected toward the average
+ *              of all the stations when it is tuned.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "data.h"
+#include "loudness.h"
+
+struct biquad {
+	float b0, b1, b2, a1, a2;
+	float z1[CAPTURE_CHANNELS], z2[CAPTURE_CHANNELS];
+};
+
+/* the two stages of the K-weighting */
+static struct biquad shelf, highpass;
+
+/* sum of squares of the current step and of the last ones */
+static double step_sum;
+static unsigned int step_frames;
+static double steps[LOUDNESS_BLOCK_STEPS];
+static unsigned int num_steps;
+
+static unsigned int histogram[LOUDNESS_BINS];
+static float bin_energy[LOUDNESS_BINS];
+static unsigned long blocks;
+
+static struct station_loudness table[LOUDNESS_MAX_STATIONS];
+static int num_stations;
+
+/* the station being measured, 0 between stations */
+static unsigned int current_khz;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int running;
+
+static struct {
+	unsigned long periods;
+	long ns;
+} stats;
+
+static float energy_to_lufs(double energy)
+{
+	return -0.691f + 10 * log10f(energy);
+}
+
+/* filters of BS.1770 at 48 kHz, moved to the capture rate */
+static void design_k_weighting(void)
+{
+	double f0 = 1681.974450955533, g = 3.999843853973347, q = 0.7071752369554196;
+	double k = tan(M_PI * f0 / CAPTURE_RATE);
+	double vh = pow(10, g / 20), vb = pow(vh, 0.4996667741545416);
+	double a0 = 1 + k / q + k * k;
+
+	memset(&shelf, 0, sizeof(shelf));
+	shelf.b0 = (vh + vb * k / q + k * k) / a0;
+	shelf.b1 = 2 * (k * k - vh) / a0;
+	shelf.b2 = (vh - vb * k / q + k * k) / a0;
+	shelf.a1 = 2 * (k * k - 1) / a0;
+	shelf.a2 = (1 - k / q + k * k) / a0;
+
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(M_PI * f0 / CAPTURE_RATE);
+	a0 = 1 + k / q + k * k;
+
+	memset(&highpass, 0, sizeof(highpass));
+	highpass.b0 = 1;
+	highpass.b1 = -2;
+	highpass.b2 = 1;
+	highpass.a1 = 2 * (k * k - 1) / a0;
+	highpass.a2 = (1 - k / q + k * k) / a0;
+}
+
+static inline float biquad_step(struct biquad *bq, int ch, float x)
+{
+	float y = bq->b0 * x + bq->z1[ch];
+
+	bq->z1[ch] = bq->b1 * x - bq->a1 * y + bq->z2[ch];
+	bq->z2[ch] = bq->b2 * x - bq->a2 * y;
+	return y;
+}
+
+static void reset_measure(void)
+{
+	memset(shelf.z1, 0, sizeof(shelf.z1));
+	memset(shelf.z2, 0, sizeof(shelf.z2));
+	memset(highpass.z1, 0, sizeof(highpass.z1));
+	memset(highpass.z2, 0, sizeof(highpass.z2));
+
+	step_sum = 0;
+	step_frames = num_steps = 0;
+	memset(histogram, 0, sizeof(histogram));
+	blocks = 0;
+}
+
+/* a 400 ms block is complete, file it in the histogram */
+static void add_block(double energy)
+{
+	float lufs;
+	int bin;
+
+	if (energy <= 0)
+		return;
+
+	lufs = energy_to_lufs(energy);
+	if (lufs < LOUDNESS_ABS_GATE)
+		return;
+
+	bin = lroundf((lufs - LOUDNESS_ABS_GATE) * 10);
+	if (bin >= LOUDNESS_BINS)
+		bin = LOUDNESS_BINS - 1;
+
+	histogram[bin]++;
+	blocks++;
+}
+
+/* integrated loudness of what was measured, with both gates */
+static float integrated(void)
+{
+	double sum = 0;
+	unsigned long count = 0;
+	float gate;
+	int i, first;
+
+	for (i = 0; i < LOUDNESS_BINS; i++)
+		sum += histogram[i] * (double)bin_energy[i];
+
+	gate = energy_to_lufs(sum / blocks) + LOUDNESS_REL_GATE;
+	first = ceilf((gate - LOUDNESS_ABS_GATE) * 10);
+	if (first < 0)
+		first = 0;
+
+	sum = 0;
+	for (i = first; i < LOUDNESS_BINS; i++) {
+		sum += histogram[i] * (double)bin_energy[i];
+		count += histogram[i];
+	}
+
+	return count ? energy_to_lufs(sum / count) : LOUDNESS_ABS_GATE;
+}
+
+/* capture thread */
+static void measure(const short *frames, unsigned int count, void *data)
+{
+	struct timespec t0, t1;
+	unsigned int i;
+	int ch;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t0);
+	pthread_mutex_lock(&lock);
+
+	for (i = 0; i < count && current_khz; i++) {
+		for (ch = 0; ch < CAPTURE_CHANNELS; ch++) {
+			float x = frames[i * CAPTURE_CHANNELS + ch] * (1.0f / 32768);
+
+			x = biquad_step(&highpass, ch, biquad_step(&shelf, ch, x));
+			step_sum += x * x;
+		}
+
+		if (++step_frames < LOUDNESS_STEP_FRAMES)
+			continue;
+
+		/* 75% overlap: every step closes a block of the last four */
+		steps[num_steps++ % LOUDNESS_BLOCK_STEPS] = step_sum;
+		step_sum = 0;
+		step_frames = 0;
+
+		if (num_steps >= LOUDNESS_BLOCK_STEPS) {
+			double sum = 0;
+			int s;
+
+			for (s = 0; s < LOUDNESS_BLOCK_STEPS; s++)
+				sum += steps[s];
+			add_block(sum / (LOUDNESS_STEP_FRAMES * LOUDNESS_BLOCK_STEPS));
+		}
+	}
+
+	pthread_mutex_unlock(&lock);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t1);
+
+	stats.periods++;
+	stats.ns += (t1.tv_sec - t0.tv_sec) * 1000000000L + t1.tv_nsec - t0.tv_nsec;
+}
+
+static struct station_loudness *find_station(unsigned int khz)
+{
+	int i;
+
+	for (i = 0; i < num_stations; i++)
+		if (table[i].khz == khz)
+			return &table[i];
+
+	return NULL;
+}
+
+/* Fold what was measured into the table, called with the lock held. When
+ * it changed, a copy goes to saved and 1 is returned: the file is written
+ * after unlocking, a slow card must not hold up the capture thread.
+ */
+static int learn(struct station_loudness *saved, int *count)
+{
+	struct station_loudness *st;
+	int lufs10;
+
+	if (!current_khz || blocks < LOUDNESS_MIN_BLOCKS)
+		return 0;
+
+	lufs10 = lroundf(integrated() * 10);
+	printf("loudness: %u kHz %.1f LUFS over %lu blocks, %ld us per period\n",
+			current_khz, lufs10 / 10.0, blocks,
+			stats.periods ? stats.ns / stats.periods / 1000 : 0);
+
+	st = find_station(current_khz);
+	if (st) {
+		/* move halfway, a single program doesn't define a station */
+		st->lufs10 = (st->lufs10 + lufs10) / 2;
+	} else if (num_stations < LOUDNESS_MAX_STATIONS) {
+		st = &table[num_stations++];
+		st->khz = current_khz;
+		st->lufs10 = lufs10;
+	} else {
+		return 0;
+	}
+
+	memcpy(saved, table, num_stations * sizeof(*table));
+	*count = num_stations;
+	return 1;
+}
+
+int loudness_start(void)
+{
+	int i;
+
+	if (running)
+		return 0;
+
+	design_k_weighting();
+
+	for (i = 0; i < LOUDNESS_BINS; i++)
+		bin_energy[i] = powf(10, (LOUDNESS_ABS_GATE + i / 10.0f + 0.691f) / 10);
+
+	num_stations = LOUDNESS_MAX_STATIONS;
+	handle_loudness(MODE_GET, table, &num_stations);
+
+	reset_measure();
+
+	if (capture_start() < 0)
+		return -1;
+
+	capture_add_tap(measure, NULL);
+	running = 1;
+	return 0;
+}
+
+void loudness_stop(void)
+{
+	struct station_loudness saved[LOUDNESS_MAX_STATIONS];
+	int count, changed;
+
+	if (!running)
+		return;
+
+	capture_remove_tap(measure, NULL);
+	capture_stop();
+
+	pthread_mutex_lock(&lock);
+	changed = learn(saved, &count);
+	pthread_mutex_unlock(&lock);
+
+	if (changed)
+		handle_loudness(MODE_SET, saved, &count);
+
+	running = 0;
+}
+
+float loudness_tune(float freq)
+{
+	struct station_loudness *st, saved[LOUDNESS_MAX_STATIONS];
+	float reference = 0, correction = 0;
+	int i, count, changed;
+
+	pthread_mutex_lock(&lock);
+
+	changed = learn(saved, &count);
+	reset_measure();
+	/* the real channel, OIRT ones are 30 kHz apart */
+	current_khz = lroundf(freq * 1000);
+
+	st = find_station(current_khz);
+	if (st) {
+		/* bring every station to the average of all of them */
+		for (i = 0; i < num_stations; i++)
+			reference += table[i].lufs10;
+		reference /= num_stations;
+
+		correction = (reference - st->lufs10) / 10;
+		if (correction > LOUDNESS_MAX_DB)
+			correction = LOUDNESS_MAX_DB;
+		else if (correction < -LOUDNESS_MAX_DB)
+			correction = -LOUDNESS_MAX_DB;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	if (changed)
+		handle_loudness(MODE_SET, saved, &count);
+
+	return correction;
+}
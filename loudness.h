@@ -0,0 +1,46 @@
+/*
+ * loudness.h - Per station loudness, measured as in ITU-R BS.1770
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* 400 ms gating blocks, one every 100 ms */
+#define LOUDNESS_STEP_FRAMES 4410
+#define LOUDNESS_BLOCK_STEPS 4
+
+/* gates of EBU R128, in LUFS and LU */
+#define LOUDNESS_ABS_GATE -70.0f
+#define LOUDNESS_REL_GATE -10.0f
+
+/* histogram of the block loudness, 0.1 LU per bin up to +5 LUFS */
+#define LOUDNESS_BINS 751
+
+/* blocks needed before a station is learned, 20 s */
+#define LOUDNESS_MIN_BLOCKS 200
+
+#define LOUDNESS_MAX_STATIONS 64
+
+/* largest correction applied to the volume, in dB */
+#define LOUDNESS_MAX_DB 9.0f
+
+/* what is kept in ~/.radioplayer/loudness */
+struct station_loudness {
+	unsigned int khz;
+	int lufs10;     /* integrated loudness in tenths of LUFS */
+};
+
+/* load what was learned and start measuring, 0 on success */
+int loudness_start(void);
+
+/* store what was measured for the current station */
+void loudness_stop(void);
+
+/* The radio moved to freq, 0 while it is between stations. What was
+ * measured is stored for the old station, and the returned value is the
+ * volume correction of the new one in dB.
+ */
+float loudness_tune(float freq);
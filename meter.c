@@ -0,0 +1,175 @@
+/*
+ * meter.c - Signal strength and stereo indicator. VIDIOC_G_TUNER is sampled
+ *           from a timerfd in the event thread, fast after a tune and
+ *           backing off to once a second while the reading doesn't move.
+ *           The main loop only hears about it when the number of bars or
+ *           the stereo flag changes.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "render.h"
+#include "events.h"
+#include "meter.h"
+#include "radio.h"
+
+#define BAR_W 6
+#define BAR_GAP 2
+#define BAR_H 20
+
+static int timer = -1;
+
+/* event thread only */
+static int ring_signal[METER_RING];
+static int ring_stereo[METER_RING];
+static int ring_len, ring_pos, stereo_count;
+static long signal_sum;
+static long interval_ms = METER_FAST_MS;
+
+/* set by the main thread, the event thread drops its samples */
+static volatile int reset = 1;
+
+/* bars | stereo << 4, as last posted by the event thread */
+static volatile int shown = -1;
+
+/* main thread only */
+static int holds;
+static int drawn = -1;
+static struct text_mask *stereo_mask;
+
+static void sample(int fd, void *data)
+{
+	SDL_Event event;
+	int signal, stereo, bars, state;
+
+	events_timer_ack(fd);
+
+	if (__sync_lock_test_and_set(&reset, 0)) {
+		ring_len = ring_pos = stereo_count = 0;
+		signal_sum = 0;
+		interval_ms = METER_FAST_MS;
+	}
+
+	if (read_signal(&signal, &stereo) < 0)
+		return;
+
+	if (ring_len == METER_RING) {
+		signal_sum -= ring_signal[ring_pos];
+		stereo_count -= ring_stereo[ring_pos];
+	} else {
+		ring_len++;
+	}
+
+	ring_signal[ring_pos] = signal;
+	ring_stereo[ring_pos] = stereo;
+	signal_sum += signal;
+	stereo_count += stereo;
+	ring_pos = (ring_pos + 1) % METER_RING;
+
+	bars = (signal_sum / ring_len * METER_BARS + 32767) / 65535;
+	state = bars | (stereo_count * 2 > ring_len) << 4;
+
+	if (state != shown) {
+		shown = state;
+
+		memset(&event, 0, sizeof(event));
+		event.type = SDL_USEREVENT;
+		event.user.code = EVENT_METER;
+		SDL_PushEvent(&event);
+		return;
+	}
+
+	/* nothing moved, look less often */
+	if (interval_ms < METER_SLOW_MS) {
+		interval_ms *= 2;
+		if (interval_ms > METER_SLOW_MS)
+			interval_ms = METER_SLOW_MS;
+		events_timer_set(fd, interval_ms, interval_ms);
+	}
+}
+
+int meter_init(TTF_Font *font)
+{
+	stereo_mask = render_text_mask(font, "ST");
+
+	timer = events_timer_new();
+	if (timer < 0 || events_add(timer, 0, sample, NULL) < 0) {
+		fprintf(stderr, "Signal meter disabled\n");
+		timer = -1;
+		return -1;
+	}
+
+	meter_retune();
+	return 0;
+}
+
+void meter_retune(void)
+{
+	reset = 1;
+
+	if (timer >= 0 && !holds)
+		events_timer_set(timer, METER_FAST_MS, METER_FAST_MS);
+}
+
+void meter_hold(int reason, int on)
+{
+	int was_held = holds != 0;
+
+	if (on)
+		holds |= reason;
+	else
+		holds &= ~reason;
+
+	if (timer < 0 || was_held == (holds != 0))
+		return;
+
+	if (holds)
+		events_timer_set(timer, 0, 0);
+	else
+		meter_retune();
+}
+
+void meter_draw(void)
+{
+	SDL_Rect rect;
+	int i, state = shown;
+
+	if (state < 0 || state == drawn)
+		return;
+	drawn = state;
+
+	rect.x = METER_X;
+	rect.y = METER_Y;
+	rect.w = METER_BARS * (BAR_W + BAR_GAP) + (stereo_mask ? stereo_mask->w : 0);
+	rect.h = BAR_H;
+	render_fill(&rect, UI_BLACK);
+
+	/* bars grow from left to right, the empty ones are outlined */
+	for (i = 0; i < METER_BARS; i++) {
+		rect.h = BAR_H * (i + 1) / METER_BARS;
+		rect.x = METER_X + i * (BAR_W + BAR_GAP);
+		rect.y = METER_Y + BAR_H - rect.h;
+		rect.w = BAR_W;
+
+		if (i < (state & 0xf))
+			render_fill(&rect, UI_GREEN);
+		else
+			render_outline(&rect, 1, UI_WHITE);
+	}
+
+	if (stereo_mask && state >> 4)
+		render_blit_mask(stereo_mask, METER_X + METER_BARS * (BAR_W + BAR_GAP),
+				METER_Y + BAR_H - stereo_mask->h, UI_WHITE);
+}
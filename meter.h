@@ -0,0 +1,38 @@
+/*
+ * meter.h - Signal strength and stereo indicator
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* sampling period right after a tune, and once the signal is stable */
+#define METER_FAST_MS 100
+#define METER_SLOW_MS 1000
+
+/* samples averaged by the meter */
+#define METER_RING 8
+
+#define METER_BARS 5
+
+#define METER_X 240
+#define METER_Y 4
+
+/* why the sampling is stopped, see meter_hold() */
+enum meter_holds {
+	METER_HOLD_SCREEN = 1,  /* locked or blanked, see power.c */
+	METER_HOLD_SEEK = 2
+};
+
+int meter_init(TTF_Font *font);
+
+/* the station changed, forget the old samples and sample fast again */
+void meter_retune(void);
+
+/* stop (on = 1) or restart the sampling for reason */
+void meter_hold(int reason, int on);
+
+/* redraw the meter if what it shows changed, called on EVENT_METER */
+void meter_draw(void);
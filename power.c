@@ -0,0 +1,250 @@
+/*
+ * power.c - UI power states. The screen dims and then blanks when no key
+ *           is pressed for a while, and is locked by the Hold switch. Once
+ *           blanked or locked nothing is drawn or sampled anymore; the
+ *           audio path doesn't depend on the UI and keeps playing. The CPU
+ *           time and the wakeups spent in every state are accounted.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "render.h"
+#include "events.h"
+#include "meter.h"
+#include "power.h"
+#include "radio.h"
+
+static const char *state_names[POWER_NUM_STATES] = {
+	[POWER_ACTIVE] = "active",
+	[POWER_DIMMED] = "dimmed",
+	[POWER_BLANKED] = "blanked",
+	[POWER_LOCKED] = "locked"
+};
+
+static int state = POWER_ACTIVE;
+static int idle_timer = -1;
+
+/* brightness file of the backlight, empty when there is none */
+static char backlight[256];
+static long bright_level = -1;
+
+static struct usage {
+	long ms;
+	long cpu_us;
+	long wakeups;
+} totals[POWER_NUM_STATES], mark;
+
+static void get_usage(struct usage *u)
+{
+	struct timespec ts;
+	struct rusage ru;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	getrusage(RUSAGE_SELF, &ru);
+
+	u->ms = ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+	u->cpu_us = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000L +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+	/* every thread that blocked and woke up again */
+	u->wakeups = ru.ru_nvcsw;
+}
+
+/* charge what was used since the last call to the current state */
+static void account(void)
+{
+	struct usage now, *t = &totals[state];
+
+	get_usage(&now);
+	t->ms += now.ms - mark.ms;
+	t->cpu_us += now.cpu_us - mark.cpu_us;
+	t->wakeups += now.wakeups - mark.wakeups;
+	mark = now;
+}
+
+static void print_usage(int s)
+{
+	struct usage *t = &totals[s];
+
+	if (!t->ms)
+		return;
+
+	printf("power: %s for %ld s, cpu %ld ms/min, %ld wakeups/min\n",
+			state_names[s], t->ms / 1000,
+			t->cpu_us * 60 / t->ms, t->wakeups * 60000 / t->ms);
+}
+
+static long sysfs_read(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	long value = -1;
+
+	if (!file)
+		return -1;
+
+	if (fscanf(file, "%ld", &value) != 1)
+		value = -1;
+
+	fclose(file);
+	return value;
+}
+
+static void set_backlight(long level)
+{
+	FILE *file;
+
+	if (!backlight[0])
+		return;
+
+	file = fopen(backlight, "w");
+	if (!file)
+		return;
+
+	fprintf(file, "%ld\n", level);
+	fclose(file);
+}
+
+/* use the first backlight the kernel knows about */
+static void find_backlight(void)
+{
+	struct dirent *entry;
+	DIR *dir = opendir(POWER_BACKLIGHT_DIR);
+
+	if (!dir)
+		return;
+
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+
+		snprintf(backlight, sizeof(backlight), "%s/%.64s/brightness",
+				POWER_BACKLIGHT_DIR, entry->d_name);
+		bright_level = sysfs_read(backlight);
+		if (bright_level > 0)
+			break;
+		backlight[0] = '\0';
+	}
+
+	closedir(dir);
+}
+
+static void idle_expired(int fd, void *data)
+{
+	SDL_Event event;
+
+	events_timer_ack(fd);
+
+	memset(&event, 0, sizeof(event));
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_IDLE;
+	SDL_PushEvent(&event);
+}
+
+static void arm_idle(long seconds)
+{
+	if (idle_timer >= 0)
+		events_timer_set(idle_timer, seconds * 1000, 0);
+}
+
+static void set_state(int new_state)
+{
+	int asleep = new_state == POWER_BLANKED || new_state == POWER_LOCKED;
+
+	if (new_state == state)
+		return;
+
+	account();
+	print_usage(state);
+	state = new_state;
+
+	switch (state) {
+	case POWER_ACTIVE:
+		set_backlight(bright_level);
+		arm_idle(POWER_DIM_S);
+		break;
+	case POWER_DIMMED:
+		set_backlight(bright_level / POWER_DIM_DIVISOR ? bright_level / POWER_DIM_DIVISOR : 1);
+		arm_idle(POWER_BLANK_S - POWER_DIM_S);
+		break;
+	default:
+		set_backlight(0);
+		arm_idle(0);
+	}
+
+	meter_hold(METER_HOLD_SCREEN, asleep);
+
+	/* waking up repaints everything from the framebuffer */
+	render_suspend(asleep);
+}
+
+int power_init(void)
+{
+	find_backlight();
+	if (!backlight[0])
+		fprintf(stderr, "No backlight found, the screen won't dim\n");
+
+	get_usage(&mark);
+
+	idle_timer = events_timer_new();
+	if (idle_timer < 0 || events_add(idle_timer, 0, idle_expired, NULL) < 0) {
+		fprintf(stderr, "Idle timer disabled\n");
+		idle_timer = -1;
+		return -1;
+	}
+
+	arm_idle(POWER_DIM_S);
+	return 0;
+}
+
+void power_exit(void)
+{
+	int i;
+
+	account();
+	for (i = 0; i < POWER_NUM_STATES; i++)
+		print_usage(i);
+
+	set_backlight(bright_level);
+}
+
+int power_activity(void)
+{
+	int was_blanked = state == POWER_BLANKED;
+
+	if (state == POWER_LOCKED)
+		return 1;
+
+	if (state == POWER_ACTIVE)
+		arm_idle(POWER_DIM_S);
+	else
+		set_state(POWER_ACTIVE);
+
+	return was_blanked;
+}
+
+void power_idle(void)
+{
+	if (state == POWER_ACTIVE)
+		set_state(POWER_DIMMED);
+	else if (state == POWER_DIMMED)
+		set_state(POWER_BLANKED);
+}
+
+void power_lock(int on)
+{
+	set_state(on ? POWER_LOCKED : POWER_ACTIVE);
+}
@@ -0,0 +1,43 @@
+/*
+ * power.h - UI power states
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* seconds without a key before the screen is dimmed, then blanked */
+#define POWER_DIM_S 20
+#define POWER_BLANK_S 60
+
+/* the dimmed backlight, as a fraction of the normal one */
+#define POWER_DIM_DIVISOR 4
+
+#define POWER_BACKLIGHT_DIR "/sys/class/backlight"
+
+/* Blanked and locked stop drawing and sampling, the audio keeps playing */
+enum power_states {
+	POWER_ACTIVE,
+	POWER_DIMMED,
+	POWER_BLANKED,
+	POWER_LOCKED,
+	POWER_NUM_STATES
+};
+
+int power_init(void);
+
+/* restore the backlight and print the time spent in each state */
+void power_exit(void);
+
+/* A key was pressed. Returns 1 when it only woke the screen up and must
+ * not do anything else.
+ */
+int power_activity(void);
+
+/* the idle timer expired, called on EVENT_IDLE */
+void power_idle(void);
+
+/* the Hold switch */
+void power_lock(int on);
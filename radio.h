@@ -19,8 +19,61 @@ void set_down(void);
 
 void mixer_control(int mode, long *volume, long *min, long *max);
 
+/* route the PCM to the outputs instead of Line In, for the DSP path;
+ * applied by the next HEADPHONE_TURN_ON or SPEAKER_TURN_ON */
+void mixer_software_path(int enable);
+
+/* the raw mixer volume db louder (or quieter) than volume */
+long mixer_volume_offset(long volume, float db);
+
+/* set Headphone and Line In Bypass at once, quietly (see ramp.c) */
+void mixer_set_level(long volume);
+
+/* the outputs, as the mixer has them */
+struct mixer_state {
+	long volume, min, max;          /* Headphone */
+	unsigned int headphone_source;  /* 1 is Line In, 0 the PCM */
+	unsigned int line_out_source;   /* same, for the speakers */
+	int speakers;
+};
+
+/* what another application changed, for mixer_watch() */
+enum mixer_changes {
+	MIXER_VOLUME = 1,
+	MIXER_ROUTING = 2
+};
+
+/* a copy of the mixer state, without asking the driver */
+void mixer_get_state(struct mixer_state *s);
+
+/* Follow the mixer from the event thread (see events.h) instead of reading
+ * it at each use. changed is called there, with the mixer_changes made by
+ * other applications. 0 on success.
+ */
+int mixer_watch(void (*changed)(int what));
+
 float seek_radio_station(int mode);
 
+/* frequency a seek in progress is probing, 0 if unknown */
+float seek_position(void);
+
+/* signal (0..65535) and stereo flag of the tuned station, 0 on success */
+int read_signal(int *signal, int *stereo);
+
+/* scan the whole band with all tuners, strongest stations first */
+int scan_band(float *stations, int max);
+
+/* Seek, scan and de-emphasis after the band plan of region, see tuner.h.
+ * A region the tuner can't receive at all falls back to the wide band.
+ */
+void set_band_region(int region);
+
+/* first and last channels of the band the tuner receives, in kHz */
+void band_range(unsigned int *lo, unsigned int *hi);
+
+/* skip silent or noisy stations found by the seek */
+void set_seek_verify(int enable);
+
 void init_controls(void);
 
 /* Modes to interact with the mixer interface */
@@ -49,9 +102,14 @@ enum modes {
 	SEEK_MANUAL
 };
 
-struct radios {
-	char radio[5][6];
-	int num_radios;
+/* SDL_USEREVENT codes, posted by the other threads to the main loop */
+enum user_events {
+	EVENT_FRAME,          /* time to draw an animation frame */
+	EVENT_SEEK_DONE,      /* the seek thread found a station */
+	EVENT_METER,          /* the signal meter changed */
+	EVENT_IDLE,           /* no key for a while, see power.c */
+	EVENT_NOW_PLAYING,    /* the song playing was named, see fingerprint.c */
+	EVENT_SCHEDULE,       /* an entry of the schedule is due, data1 is a copy */
+	EVENT_SLEEP,          /* the sleep timer faded the radio out */
+	EVENT_MIXER           /* another application changed the mixer, data1 */
 };
-
-struct radios favrads;
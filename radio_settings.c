@@ -14,31 +14,90 @@
  */
 
 #include <alsa/asoundlib.h>
-#include <fcntl.h>
 #include <linux/videodev2.h>
-#include <sys/ioctl.h>
+#include <pthread.h>
 #include <unistd.h>
 
+#include "events.h"
 #include "radio.h"
+#include "trace.h"
+#include "tuner.h"
+#include "verify.h"
 
-/* file descriptor of radio device */
-static int fd;
+/* dead carriers skipped by one seek, before giving up */
+#define VERIFY_MAX_SKIPS 20
+
+/* all radio devices found, the first one plays the radio */
+static struct tuner_dev tuners[MAX_TUNERS];
+static int num_tuners;
+
+/* the tuner we listen to */
+static struct tuner_dev *dev;
 
 static struct v4l2_control control;
 static struct v4l2_frequency freq;
-static struct v4l2_tuner tuner;
 static struct v4l2_hw_freq_seek seek;
 
-/* init the fd global variable and set the initial config for seek */
+/* check the audio of each station found, and skip silence and noise */
+static int seek_verify;
+
+/* mixer session, opened once and shared with the volume ramp thread */
+static snd_mixer_t *mixer;
+static pthread_mutex_t mixer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the outputs play the PCM (the DSP path) instead of Line In */
+static int software_path;
+
+/* the mixer elements mirrored in state */
+enum {
+	ELEM_HEADPHONE,
+	ELEM_HEADPHONE_SOURCE,
+	ELEM_LINE_OUT_SOURCE,
+	ELEM_SPEAKERS,
+	NUM_ELEMS
+};
+
+static const char *const elem_names[NUM_ELEMS] = {
+	"Headphone", "Headphone Source", "Line Out Source", "Speakers"
+};
+
+static snd_mixer_elem_t *elems[NUM_ELEMS];
+
+/* the outputs as the mixer has them, refreshed by the element callbacks
+ * each time the session handles its events, under the mixer lock */
+static struct mixer_state state;
+
+/* the event thread handles the mixer events, see mixer_watch() */
+static int watched;
+static void (*mixer_notify)(int what);
+
+/* the radio can't go on, keep the trace of how it got here */
+static void fatal(void)
+{
+	trace_add(TRACE_FATAL, TRACE_DUMP_FATAL, 0, 0, 0);
+	trace_dump(TRACE_DUMP_FATAL);
+	exit(1);
+}
+
+/* find all tuners and set the initial config for seek */
 void init_controls(void)
 {
-	fd = open("/dev/radio0", O_RDONLY);
+	int i;
+
+	/* RADIO_SIM=<n> runs against n simulated tuners, to use it in a host */
+	num_tuners = tuner_enumerate(tuners, MAX_TUNERS);
 
-	if (fd < 0) {
-		fprintf(stderr, "Radio device /dev/radio0 not found! Aborting.\n");
-		exit(1);
+	if (!num_tuners) {
+		fprintf(stderr, "No radio device found in /dev! Aborting.\n");
+		fatal();
 	}
 
+	for (i = 0; i < num_tuners; i++)
+		printf("Tuner %s: %s seek\n", tuners[i].path,
+				tuners[i].hw_seek ? "hardware" : "software");
+
+	dev = &tuners[0];
+
 	/* initial values for seek */
 	seek.tuner = 0;
 	seek.type = V4L2_TUNER_RADIO;
@@ -47,17 +106,65 @@ void init_controls(void)
 
 void set_frequency(float frequency)
 {
-	/* convert MHz to Hz*/
-	int n_freq = (frequency * 1000000) / 62.5;
+	/* convert MHz to the tuner unit */
+	int n_freq = tuner_khz_to_units(&dev->tuner, frequency * 1000 + 0.5);
 
 	freq.tuner = 0;
 	freq.frequency = n_freq;
 	freq.type = V4L2_TUNER_RADIO;
 
-	if (ioctl(fd, VIDIOC_S_FREQUENCY, &freq) < 0) {
+	if (tuner_ioctl(dev->fd, VIDIOC_S_FREQUENCY, &freq) < 0) {
 		perror("ioctl: set frequency");
 		fprintf(stderr, "We can't continue without a frequency. Aborting.\n");
-		exit(1);
+		fatal();
+	}
+}
+
+/* the de-emphasis of the region, drivers without the control keep theirs */
+static void set_deemphasis(void)
+{
+	const struct band_plan *plan = band_active();
+
+	if (!plan->deemphasis_us)
+		return;
+
+	control.id = V4L2_CID_TUNE_DEEMPHASIS;
+	control.value = plan->deemphasis_us == 75 ? V4L2_DEEMPHASIS_75_uS :
+		V4L2_DEEMPHASIS_50_uS;
+
+	if (tuner_ioctl(dev->fd, VIDIOC_S_CTRL, &control) < 0)
+		perror("ioctl: set de-emphasis");
+}
+
+void set_band_region(int region)
+{
+	const struct band_plan *plan = band_plan(region);
+	unsigned int lo, hi;
+
+	/* nothing of the band would ever tune, the wide one at least does */
+	if (dev && tuner_band_range(&dev->tuner, plan, &lo, &hi) < 0) {
+		fprintf(stderr, "Tuner %s can't receive the %s band, using the wide one\n",
+				dev->path, plan->name);
+		region = BAND_WIDE;
+		plan = band_plan(region);
+	}
+
+	band_select(region);
+	printf("Band %s: %.2f - %.2f MHz, %u kHz steps, %u channels\n", plan->name,
+			plan->min_khz / 1000.0, plan->max_khz / 1000.0, plan->step_khz,
+			plan->channels);
+
+	if (dev)
+		set_deemphasis();
+}
+
+void band_range(unsigned int *lo, unsigned int *hi)
+{
+	const struct band_plan *plan = band_active();
+
+	if (!dev || tuner_band_range(&dev->tuner, plan, lo, hi) < 0) {
+		*lo = plan->min_khz;
+		*hi = plan->max_khz;
 	}
 }
 
@@ -67,16 +174,16 @@ void setup(float frequency)
 	control.id = V4L2_CID_AUDIO_MUTE;
 	control.value = 0;
 
-	if (ioctl(fd, VIDIOC_S_CTRL, &control) < 0) {
+	if (tuner_ioctl(dev->fd, VIDIOC_S_CTRL, &control) < 0) {
 		perror("ioctl: set: mute off");
 		fprintf(stderr, "We can't continue without turns mute to off. Aborting.\n");
-		exit(1);
+		fatal();
 	}
 
-	if (ioctl(fd, VIDIOC_G_TUNER, &tuner) < 0) {
+	if (tuner_ioctl(dev->fd, VIDIOC_G_TUNER, &dev->tuner) < 0) {
 		perror("ioctl: set: get tuner");
 		fprintf(stderr, "We can't continue without a tuner. Aborting.\n");
-		exit(1);
+		fatal();
 	}
 
 	set_frequency(frequency);
@@ -84,35 +191,189 @@ void setup(float frequency)
 	control.id = V4L2_CID_AUDIO_VOLUME;
 	control.value = 15;
 
-	if (ioctl(fd, VIDIOC_S_CTRL, &control) < 0) {
+	if (tuner_ioctl(dev->fd, VIDIOC_S_CTRL, &control) < 0) {
 		perror("ioctl: set volume");
 		fprintf(stderr, "Using the default volume level.\n");
 	}
+
+	set_deemphasis();
 }
 
-/* seek for next/previous radio station */
-float seek_radio_station(int mode)
+/* seek by stepping the tuner, when the hardware seek is not available */
+static void software_seek(int upward)
 {
-	if (mode == SEEK_UP) {
-		seek.seek_upward = 1;
+	struct sw_seek_stats stats;
+	unsigned int khz;
 
-		if (ioctl(fd, VIDIOC_S_HW_FREQ_SEEK, &seek) < 0) {
-			perror("icotl: seek frequency up");
-			fprintf(stderr, "Fail to seekup\n");
+	tuner_ioctl(dev->fd, VIDIOC_G_FREQUENCY, &freq);
+	khz = tuner_units_to_khz(&dev->tuner, freq.frequency);
+
+	if (sw_seek(dev, &khz, upward, &stats) < 0)
+		fprintf(stderr, "No station found\n");
+
+	printf("Software seek: %d probes, %d refines, %ld ms, settle %ld us\n",
+			stats.probes, stats.refines, stats.elapsed_ms, stats.settle_us);
+}
+
+/* Without programmable limits the hardware seek may stop outside the plan,
+ * and a driver may ignore the spacing: a station off the raster is snapped
+ * to it, one out of the band is sought again in software from start.
+ */
+static void check_hw_seek(unsigned int start, int upward)
+{
+	unsigned int khz, lo, hi;
+
+	tuner_ioctl(dev->fd, VIDIOC_G_FREQUENCY, &freq);
+	khz = tuner_units_to_khz(&dev->tuner, freq.frequency);
+
+	if (tuner_band_range(&dev->tuner, band_active(), &lo, &hi) < 0)
+		return;
+
+	if (khz < lo || khz > hi) {
+		printf("Hardware seek left the band at %u kHz\n", khz);
+		freq.frequency = start;
+		tuner_ioctl(dev->fd, VIDIOC_S_FREQUENCY, &freq);
+		software_seek(upward);
+	} else if (band_snap(khz) != khz) {
+		freq.frequency = tuner_khz_to_units(&dev->tuner, band_snap(khz));
+		tuner_ioctl(dev->fd, VIDIOC_S_FREQUENCY, &freq);
+	}
+}
+
+static float seek_once(int mode)
+{
+	const struct band_plan *plan = band_active();
+	unsigned int lo, hi, start;
+
+	if (mode == SEEK_UP || mode == SEEK_DOWN) {
+		seek.seek_upward = mode == SEEK_UP;
+
+		/* the hardware seek keeps to the channels of the region too */
+		seek.spacing = plan->step_khz * 1000;
+		seek.rangelow = seek.rangehigh = 0;
+		if ((dev->tuner.capability & V4L2_TUNER_CAP_HWSEEK_PROG_LIM) &&
+				!tuner_band_range(&dev->tuner, plan, &lo, &hi)) {
+			seek.rangelow = tuner_khz_to_units(&dev->tuner, lo);
+			seek.rangehigh = tuner_khz_to_units(&dev->tuner, hi);
 		}
 
-	} else if (mode == SEEK_DOWN) {
-		seek.seek_upward = 0;
+		if (dev->hw_seek) {
+			tuner_ioctl(dev->fd, VIDIOC_G_FREQUENCY, &freq);
+			start = freq.frequency;
 
-		if (ioctl(fd, VIDIOC_S_HW_FREQ_SEEK, &seek) < 0) {
-			perror("icotl: seek frequency up");
-			fprintf(stderr, "Fail to seekdown\n");
+			if (tuner_ioctl(dev->fd, VIDIOC_S_HW_FREQ_SEEK, &seek) < 0) {
+				int err = errno;
+
+				perror("ioctl: seek frequency");
+
+				/* the driver doesn't know how to seek, don't try it again */
+				if (err == ENOTTY || err == EINVAL) {
+					fprintf(stderr, "Hardware seek not supported, using software seek\n");
+					dev->hw_seek = 0;
+				}
+			} else {
+				check_hw_seek(start, seek.seek_upward);
+			}
 		}
+
+		if (!dev->hw_seek)
+			software_seek(seek.seek_upward);
+	}
+
+	tuner_ioctl(dev->fd, VIDIOC_G_FREQUENCY, &freq);
+
+	return tuner_units_to_khz(&dev->tuner, freq.frequency) / 1000.0;
+}
+
+void set_seek_verify(int enable)
+{
+	if (enable == seek_verify)
+		return;
+
+	if (verify_enable(enable) < 0) {
+		fprintf(stderr, "Cannot capture Line In, seek verification disabled\n");
+		return;
+	}
+
+	seek_verify = enable;
+}
+
+/* seek for next/previous radio station */
+float seek_radio_station(int mode)
+{
+	struct audio_features feat;
+	float first = seek_once(mode), station = first;
+	int skips = 0;
+
+	while (seek_verify && skips < VERIFY_MAX_SKIPS) {
+		int class = verify_station(&feat);
+
+		/* out of time budget counts as a good station */
+		if (class < 0 || class == AUDIO_PROGRAM)
+			break;
+
+		printf("Skipping %.1f: %s (rms %d, flatness %.2f, zcr %.2f)\n", station,
+				class == AUDIO_SILENCE ? "silence" : "noise",
+				feat.rms, feat.flatness, feat.zcr);
+
+		skips++;
+		station = seek_once(mode);
+
+		/* went around the whole band */
+		if (station == first)
+			break;
+	}
+
+	return station;
+}
+
+float seek_position(void)
+{
+	/* the hardware seek doesn't tell where it is */
+	if (dev->hw_seek)
+		return 0;
+
+	return dev->probe_khz / 1000.0;
+}
+
+int read_signal(int *signal, int *stereo)
+{
+	struct v4l2_tuner tuner;
+
+	memset(&tuner, 0, sizeof(tuner));
+
+	if (tuner_ioctl(dev->fd, VIDIOC_G_TUNER, &tuner) < 0)
+		return -1;
+
+	*signal = tuner.signal;
+	*stereo = (tuner.rxsubchans & V4L2_TUNER_SUB_STEREO) != 0;
+
+	return 0;
+}
+
+int scan_band(float *stations, int max)
+{
+	struct station found[128];
+	long elapsed = 0;
+	int i, count;
+
+	count = tuner_scan(tuners, num_tuners, found, 128, &elapsed);
+	printf("Band scan: %d stations with %d tuners in %ld ms\n", count, num_tuners, elapsed);
+
+	/* strongest stations first */
+	for (i = 1; i < count; i++) {
+		struct station tmp = found[i];
+		int j = i;
+
+		for (; j > 0 && found[j - 1].signal < tmp.signal; j--)
+			found[j] = found[j - 1];
+		found[j] = tmp;
 	}
 
-	ioctl(fd, VIDIOC_G_FREQUENCY, &freq);
+	for (i = 0; i < count && i < max; i++)
+		stations[i] = found[i].khz / 1000.0;
 
-	return (freq.frequency * 62.5) / 1000000;
+	return i;
 }
 
 /* Close all handles and free all allocated memory */
@@ -121,7 +382,7 @@ void set_down(void)
 	control.id = V4L2_CID_AUDIO_MUTE;
 	control.value = 1;
 
-	if (ioctl(fd, VIDIOC_S_CTRL, &control) < 0) {
+	if (tuner_ioctl(dev->fd, VIDIOC_S_CTRL, &control) < 0) {
 		perror("radio disable");
 		fprintf(stderr, "Failed to disable the radio");
 	}
@@ -129,19 +390,223 @@ void set_down(void)
 	fprintf(stdout, "Exiting..bye!\n");
 }
 
+/* called with the mixer lock held */
+static void read_state(void)
+{
+	snd_mixer_selem_channel_id_t channel = SND_MIXER_SCHN_FRONT_LEFT;
+
+	if (elems[ELEM_HEADPHONE])
+		snd_mixer_selem_get_playback_volume(elems[ELEM_HEADPHONE], channel,
+				&state.volume);
+	if (elems[ELEM_HEADPHONE_SOURCE])
+		snd_mixer_selem_get_enum_item(elems[ELEM_HEADPHONE_SOURCE], channel,
+				&state.headphone_source);
+	if (elems[ELEM_LINE_OUT_SOURCE])
+		snd_mixer_selem_get_enum_item(elems[ELEM_LINE_OUT_SOURCE], channel,
+				&state.line_out_source);
+	if (elems[ELEM_SPEAKERS])
+		snd_mixer_selem_get_playback_switch(elems[ELEM_SPEAKERS], channel,
+				&state.speakers);
+}
+
+/* called by snd_mixer_handle_events() for the elements of elem_names */
+static int elem_changed(snd_mixer_elem_t *elem, unsigned int mask)
+{
+	int i;
+
+	if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+		for (i = 0; i < NUM_ELEMS; i++)
+			if (elems[i] == elem)
+				elems[i] = NULL;
+		return 0;
+	}
+
+	read_state();
+	return 0;
+}
+
+/* open the mixer at the first use, and keep it up to date after that */
+static snd_mixer_t *mixer_session(void)
+{
+	snd_mixer_selem_id_t *sid;
+	int i;
+
+	if (!mixer) {
+		snd_mixer_open(&mixer, 0);
+		snd_mixer_attach(mixer, "default");
+		snd_mixer_selem_register(mixer, NULL, NULL);
+		snd_mixer_load(mixer);
+
+		snd_mixer_selem_id_alloca(&sid);
+		snd_mixer_selem_id_set_index(sid, 0);
+
+		for (i = 0; i < NUM_ELEMS; i++) {
+			snd_mixer_selem_id_set_name(sid, elem_names[i]);
+			elems[i] = snd_mixer_find_selem(mixer, sid);
+			if (elems[i])
+				snd_mixer_elem_set_callback(elems[i], elem_changed);
+		}
+
+		if (elems[ELEM_HEADPHONE])
+			snd_mixer_selem_get_playback_volume_range(elems[ELEM_HEADPHONE],
+					&state.min, &state.max);
+		read_state();
+	} else if (!watched) {
+		/* pick up changes made by other applications */
+		snd_mixer_handle_events(mixer);
+	}
+
+	return mixer;
+}
+
+/* event thread, the mixer has events: pass on what others changed, our own
+ * changes are in state already */
+static void mixer_ready(int fd, void *data)
+{
+	struct mixer_state old;
+	long volume;
+	int what = 0;
+
+	pthread_mutex_lock(&mixer_lock);
+	old = state;
+	snd_mixer_handle_events(mixer);
+
+	if (state.volume != old.volume)
+		what |= MIXER_VOLUME;
+	if (state.headphone_source != old.headphone_source ||
+			state.line_out_source != old.line_out_source ||
+			state.speakers != old.speakers)
+		what |= MIXER_ROUTING;
+	volume = state.volume;
+	pthread_mutex_unlock(&mixer_lock);
+
+	if (what)
+		trace_add(TRACE_MIXER_CHANGE, what, volume, 0, 0);
+	if (what && mixer_notify)
+		mixer_notify(what);
+}
+
+int mixer_watch(void (*changed)(int what))
+{
+	struct pollfd fds[EVENTS_MAX_FDS];
+	int i, count;
+
+	pthread_mutex_lock(&mixer_lock);
+	mixer_session();
+	count = snd_mixer_poll_descriptors_count(mixer);
+	if (count > EVENTS_MAX_FDS)
+		count = EVENTS_MAX_FDS;
+	count = snd_mixer_poll_descriptors(mixer, fds, count);
+	mixer_notify = changed;
+	pthread_mutex_unlock(&mixer_lock);
+
+	/* not under the mixer lock, the ramp takes it from the event thread */
+	for (i = 0; i < count; i++) {
+		if (events_add(fds[i].fd, fds[i].events, mixer_ready, NULL) < 0) {
+			while (i--)
+				events_remove(fds[i].fd);
+			fprintf(stderr, "Failed to watch the mixer\n");
+			return -1;
+		}
+	}
+
+	pthread_mutex_lock(&mixer_lock);
+	watched = count > 0;
+	pthread_mutex_unlock(&mixer_lock);
+
+	return watched ? 0 : -1;
+}
+
+void mixer_get_state(struct mixer_state *s)
+{
+	pthread_mutex_lock(&mixer_lock);
+	mixer_session();
+	*s = state;
+	pthread_mutex_unlock(&mixer_lock);
+}
+
+void mixer_software_path(int enable)
+{
+	pthread_mutex_lock(&mixer_lock);
+	software_path = enable;
+	pthread_mutex_unlock(&mixer_lock);
+}
+
+long mixer_volume_offset(long volume, float db)
+{
+	snd_mixer_selem_id_t *sid;
+	snd_mixer_elem_t *elem;
+	long cur_db, min, max, value = volume;
+
+	/* muted stays muted */
+	if (!volume || !db)
+		return volume;
+
+	pthread_mutex_lock(&mixer_lock);
+
+	snd_mixer_selem_id_alloca(&sid);
+	snd_mixer_selem_id_set_index(sid, 0);
+	snd_mixer_selem_id_set_name(sid, "Headphone");
+	elem = snd_mixer_find_selem(mixer_session(), sid);
+
+	/* round toward the volume the user chose */
+	if (elem && !snd_mixer_selem_ask_playback_vol_dB(elem, volume, &cur_db) &&
+			!snd_mixer_selem_ask_playback_dB_vol(elem, cur_db + db * 100,
+				db > 0 ? -1 : 1, &value)) {
+		snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
+		if (value < min + 1)
+			value = min + 1;
+		if (value > max)
+			value = max;
+	}
+
+	pthread_mutex_unlock(&mixer_lock);
+
+	return value;
+}
+
+/* set the radio volume without noise, used by the volume ramp */
+void mixer_set_level(long volume)
+{
+	uint64_t start = trace_now();
+	snd_mixer_selem_id_t *sid;
+	snd_mixer_elem_t *elem;
+	snd_mixer_t *handle;
+
+	pthread_mutex_lock(&mixer_lock);
+	handle = mixer_session();
+
+	snd_mixer_selem_id_alloca(&sid);
+	snd_mixer_selem_id_set_index(sid, 0);
+
+	snd_mixer_selem_id_set_name(sid, "Headphone");
+	elem = snd_mixer_find_selem(handle, sid);
+	if (elem)
+		snd_mixer_selem_set_playback_volume_all(elem, volume);
+
+	snd_mixer_selem_id_set_name(sid, "Line In Bypass");
+	elem = snd_mixer_find_selem(handle, sid);
+	if (elem)
+		snd_mixer_selem_set_playback_volume_all(elem, volume);
+
+	read_state();
+	pthread_mutex_unlock(&mixer_lock);
+
+	trace_add(TRACE_MIXER_LEVEL, 0, volume, 0, start);
+}
+
 /* Controls the alsamixer atributes of GCW device */
 void mixer_control(int mode, long *volume, long *min, long *max)
 {
+	uint64_t start = trace_now();
 	snd_mixer_t *handle;
 	snd_mixer_selem_id_t *sid;
 	snd_mixer_elem_t *elem;
 
 	snd_mixer_selem_channel_id_t channel = SND_MIXER_SCHN_FRONT_LEFT;
 
-	snd_mixer_open(&handle, 0);
-	snd_mixer_attach(handle, "default");
-	snd_mixer_selem_register(handle, NULL, NULL);
-	snd_mixer_load(handle);
+	pthread_mutex_lock(&mixer_lock);
+	handle = mixer_session();
 
 	snd_mixer_selem_id_alloca(&sid);
 	snd_mixer_selem_id_set_index(sid, 0);
@@ -151,8 +616,9 @@ void mixer_control(int mode, long *volume, long *min, long *max)
 		elem = snd_mixer_find_selem(handle, sid);
 	
 		if (mode == VOLUME_GET) {
-			snd_mixer_selem_get_playback_volume(elem, channel, volume);
-			snd_mixer_selem_get_playback_volume_range(elem, min, max);
+			*volume = state.volume;
+			*min = state.min;
+			*max = state.max;
 		} else if (mode == VOLUME_SET) {
 			printf("GCW: Volume set to %ld\n", *volume);
 			snd_mixer_selem_set_playback_volume_all(elem, *volume);
@@ -171,7 +637,10 @@ void mixer_control(int mode, long *volume, long *min, long *max)
 		snd_mixer_selem_id_set_name(sid, "Headphone Source");
 		elem = snd_mixer_find_selem(handle, sid);
 
-		if (mode == HEADPHONE_TURN_ON) {
+		if (mode == HEADPHONE_TURN_ON && software_path) {
+			printf("Headphone Source: PCM (DSP)\n");
+			snd_mixer_selem_set_enum_item(elem, channel, 0);
+		} else if (mode == HEADPHONE_TURN_ON) {
 			printf("Headphone Source: Line In\n");
 			snd_mixer_selem_set_enum_item(elem, channel, 1);
 		} else if (mode == HEADPHONE_TURN_OFF) {
@@ -196,34 +665,20 @@ void mixer_control(int mode, long *volume, long *min, long *max)
 
 		if (mode == SPEAKER_TURN_ON) {
 			printf("Line Out Source turned on\n");
-			snd_mixer_selem_set_enum_item(elem, channel, 1);
+			snd_mixer_selem_set_enum_item(elem, channel, !software_path);
 		} else if (mode == SPEAKER_TURN_OFF) {
 			printf("Line Out Source turned off\n");
 			snd_mixer_selem_set_enum_item(elem, channel, 0);
 		}
 	} else if (mode == BYPASS_VERIFICATION) {
-		// volume here means that the radio is running in background or not
-		*volume = 0;
-
-		unsigned int setting = 0;
-		snd_mixer_selem_id_set_name(sid, "Headphone Source");
-		elem = snd_mixer_find_selem(handle, sid);
-
-		snd_mixer_selem_get_enum_item(elem, channel, &setting);
-
-		// the headphone is turned on
-		if (setting == 1) {
-			*volume = 1;
-			return;
-		}
-
-		snd_mixer_selem_id_set_name(sid, "Line Out Source");
-		elem = snd_mixer_find_selem(handle, sid);
+		// volume here means that the radio is running in background or not:
+		// the headphone or the speakers play Line In. If both are off, the
+		// screen needs to setup the radio
+		*volume = state.headphone_source == 1 || state.line_out_source == 1;
+	}
 
-		snd_mixer_selem_get_enum_item(elem, channel, &setting);
+	read_state();
+	pthread_mutex_unlock(&mixer_lock);
 
-		// if both headphone and speakers are off, return 0 in volume to tell the screen that we need 
-		// to setup the radio
-		*volume = setting == 1;
-	}
+	trace_add(TRACE_MIXER, mode, volume ? *volume : 0, 0, start);
 }
@@ -0,0 +1,173 @@
+/*
+ * ramp.c - Volume ramps driven by a timerfd in the event thread. The level
+ *          follows a smoothstep curve over the mixer steps, which are dB
+ *          steps already, so the fade sounds even from start to end.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "events.h"
+#include "radio.h"
+#include "ramp.h"
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t idle;
+	int timer;
+	int active;
+	long current;        /* level set in the mixer */
+	long start;
+	long target;
+	long t0_us;
+	long duration_us;
+} ramp = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+	.timer = -1
+};
+
+static long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* called with the lock held */
+static void ramp_finish(void)
+{
+	ramp.active = 0;
+	if (ramp.timer >= 0)
+		events_timer_set(ramp.timer, 0, 0);
+	pthread_cond_broadcast(&ramp.idle);
+}
+
+static void ramp_tick(int fd, void *data)
+{
+	long elapsed, level;
+	float p;
+
+	events_timer_ack(fd);
+
+	pthread_mutex_lock(&ramp.lock);
+	if (ramp.active) {
+		elapsed = now_us() - ramp.t0_us;
+		p = elapsed >= ramp.duration_us ? 1 : (float)elapsed / ramp.duration_us;
+		p = p * p * (3 - 2 * p);
+
+		level = ramp.start + lroundf((ramp.target - ramp.start) * p);
+
+		if (level != ramp.current) {
+			mixer_set_level(level);
+			ramp.current = level;
+		}
+
+		if (elapsed >= ramp.duration_us)
+			ramp_finish();
+	}
+	pthread_mutex_unlock(&ramp.lock);
+}
+
+int ramp_init(long level)
+{
+	ramp.current = ramp.target = level;
+
+	ramp.timer = events_timer_new();
+	if (ramp.timer < 0 || events_add(ramp.timer, 0, ramp_tick, NULL) < 0) {
+		fprintf(stderr, "Volume ramps disabled\n");
+		ramp.timer = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+void ramp_to(long target, int ms)
+{
+	if (ms > RAMP_MAX_MS)
+		ms = RAMP_MAX_MS;
+
+	pthread_mutex_lock(&ramp.lock);
+	ramp.start = ramp.current;
+	ramp.target = target;
+	ramp.t0_us = now_us();
+	ramp.duration_us = ms * 1000L;
+
+	/* nothing to fade, or no timer to do it */
+	if (ms <= 0 || ramp.timer < 0 || ramp.start == target) {
+		if (ramp.current != target)
+			mixer_set_level(target);
+		ramp.current = target;
+		ramp_finish();
+	} else if (!ramp.active) {
+		ramp.active = 1;
+		events_timer_set(ramp.timer, RAMP_TICK_MS, RAMP_TICK_MS);
+	}
+	pthread_mutex_unlock(&ramp.lock);
+}
+
+void ramp_set(long level)
+{
+	ramp_to(level, 0);
+}
+
+void ramp_sync(long level)
+{
+	pthread_mutex_lock(&ramp.lock);
+	ramp.current = ramp.target = level;
+	if (ramp.active)
+		ramp_finish();
+	pthread_mutex_unlock(&ramp.lock);
+}
+
+void ramp_wait(void)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += RAMP_MAX_MS * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&ramp.lock);
+	while (ramp.active && ret != ETIMEDOUT)
+		ret = pthread_cond_timedwait(&ramp.idle, &ramp.lock, &deadline);
+
+	/* too late, land where the fade was going */
+	if (ramp.active) {
+		mixer_set_level(ramp.target);
+		ramp.current = ramp.target;
+		ramp_finish();
+	}
+	pthread_mutex_unlock(&ramp.lock);
+}
+
+long ramp_target(void)
+{
+	long target;
+
+	pthread_mutex_lock(&ramp.lock);
+	target = ramp.target;
+	pthread_mutex_unlock(&ramp.lock);
+
+	return target;
+}
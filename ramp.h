@@ -0,0 +1,39 @@
+/*
+ * ramp.h - Volume ramps, to avoid pops when the audio path changes
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define RAMP_TICK_MS 2
+
+/* a fade out plus a fade in never take longer than RAMP_MAX_MS */
+#define RAMP_MAX_MS 30
+#define RAMP_OUT_MS 10
+#define RAMP_IN_MS 20
+
+/* volume keys, short enough to follow the key repeat */
+#define RAMP_STEP_MS 6
+
+/* the mixer is at level now, it needs the event thread running */
+int ramp_init(long level);
+
+/* Fade from wherever the volume is to target in ms. A fade in flight is
+ * cancelled and the new one starts from the level it reached.
+ */
+void ramp_to(long target, int ms);
+
+/* jump to level at once, cancelling any fade */
+void ramp_set(long level);
+
+/* the mixer was moved to level by someone else, stay there */
+void ramp_sync(long level);
+
+/* wait for the fade in flight, never longer than RAMP_MAX_MS */
+void ramp_wait(void);
+
+/* level the last fade goes to */
+long ramp_target(void);
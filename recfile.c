@@ -0,0 +1,435 @@
+/*
+ * recfile.c - Recording container. The audio is written in blocks of one
+ *             second, each one with a small header, and every block gets
+ *             an entry in a sidecar index of fixed size records. Seeking
+ *             is a binary search in the mapped index and one read, a clip
+ *             is a copy of whole blocks, and a recording cut by a power
+ *             loss is indexed again by walking its block headers.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "recfile.h"
+
+/* bounce buffer when copy_file_range is not there (before Linux 4.5) */
+#define COPY_CHUNK 65536
+
+static void index_name(const char *path, char *out, int size)
+{
+	snprintf(out, size, "%s%s", path, REC_INDEX_SUFFIX);
+}
+
+uint32_t rec_block_check(const struct rec_block *block)
+{
+	const unsigned char *p = (const unsigned char *)block;
+	uint32_t hash = 2166136261u;
+	unsigned int i;
+
+	/* FNV-1a of everything before the check itself */
+	for (i = 0; i < offsetof(struct rec_block, check); i++)
+		hash = (hash ^ p[i]) * 16777619u;
+
+	return hash;
+}
+
+int rec_create(struct rec_writer *w, const char *path, uint32_t rate,
+		uint16_t channels, uint32_t block_frames, uint64_t start_ms)
+{
+	struct rec_header header;
+	char name[512];
+
+	memset(w, 0, sizeof(*w));
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, REC_MAGIC, sizeof(header.magic));
+	header.rate = rate;
+	header.channels = channels;
+	header.bits = 16;
+	header.start_ms = start_ms;
+	header.block_frames = block_frames;
+
+	w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	index_name(path, name, sizeof(name));
+	w->index_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (w->fd < 0 || w->index_fd < 0 ||
+			write(w->fd, &header, sizeof(header)) != sizeof(header)) {
+		perror(path);
+		rec_close_writer(w);
+		return -1;
+	}
+
+	w->offset = sizeof(header);
+	w->channels = channels;
+	return 0;
+}
+
+/* a block failed half way: the files end where the last good one does,
+ * so the next block goes where this one was and the index stays right */
+static void drop_block(struct rec_writer *w, off_t index_end)
+{
+	if (ftruncate(w->fd, w->offset) < 0 || lseek(w->fd, w->offset, SEEK_SET) < 0)
+		perror("rec: truncate");
+	if (index_end >= 0 && (ftruncate(w->index_fd, index_end) < 0 ||
+				lseek(w->index_fd, index_end, SEEK_SET) < 0))
+		perror("rec: truncate index");
+}
+
+int rec_write_block(struct rec_writer *w, const struct iovec *iov, int iovcnt,
+		uint32_t frames, uint64_t time_ms, uint32_t khz)
+{
+	struct iovec all[4];
+	struct rec_block block;
+	struct rec_index entry;
+	size_t bytes = sizeof(block) + (size_t)frames * w->channels * 2;
+	off_t index_end;
+	int i;
+
+	if (iovcnt > 3)
+		return -1;
+
+	block.magic = REC_BLOCK_MAGIC;
+	block.frames = frames;
+	block.time_ms = time_ms;
+	block.khz = khz;
+	block.check = rec_block_check(&block);
+
+	all[0].iov_base = &block;
+	all[0].iov_len = sizeof(block);
+	for (i = 0; i < iovcnt; i++)
+		all[i + 1] = iov[i];
+
+	if (writev(w->fd, all, iovcnt + 1) != (ssize_t)bytes) {
+		perror("rec: write");
+		drop_block(w, -1);
+		return -1;
+	}
+
+	/* the index entry goes after its block, a torn index is only short */
+	entry.offset = w->offset;
+	entry.time_ms = time_ms;
+	entry.khz = khz;
+	entry.flags = khz != w->khz || w->offset == sizeof(struct rec_header) ? REC_MARK_TUNE : 0;
+
+	index_end = lseek(w->index_fd, 0, SEEK_CUR);
+	if (write(w->index_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+		perror("rec: index");
+		drop_block(w, index_end);
+		return -1;
+	}
+
+	w->offset += bytes;
+	w->khz = khz;
+	return 0;
+}
+
+void rec_close_writer(struct rec_writer *w)
+{
+	if (w->fd >= 0)
+		close(w->fd);
+	if (w->index_fd >= 0)
+		close(w->index_fd);
+	w->fd = w->index_fd = -1;
+}
+
+/* read the header of the block at pos, returns where the block ends or
+ * 0 when there is no block there */
+static uint64_t block_end(int fd, const struct rec_header *header, uint64_t pos,
+		struct rec_block *block)
+{
+	if (pread(fd, block, sizeof(*block), pos) != sizeof(*block) ||
+			block->magic != REC_BLOCK_MAGIC || block->check != rec_block_check(block))
+		return 0;
+
+	return pos + sizeof(*block) + (uint64_t)block->frames * header->channels * 2;
+}
+
+long rec_rebuild_index(const char *path)
+{
+	struct rec_header header;
+	struct rec_block block;
+	struct rec_index entry;
+	struct stat st;
+	char name[512];
+	uint64_t pos, end;
+	uint32_t khz = 0;
+	FILE *out;
+	long count = 0;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0 ||
+			pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+			memcmp(header.magic, REC_MAGIC, sizeof(header.magic))) {
+		fprintf(stderr, "%s: not a recording\n", path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	index_name(path, name, sizeof(name));
+	out = fopen(name, "w");
+	if (!out) {
+		perror(name);
+		close(fd);
+		return -1;
+	}
+
+	/* one header read per block, the audio itself is never read */
+	for (pos = sizeof(header); pos < (uint64_t)st.st_size; pos = end) {
+		end = block_end(fd, &header, pos, &block);
+		if (!end || end > (uint64_t)st.st_size)
+			break;
+
+		entry.offset = pos;
+		entry.time_ms = block.time_ms;
+		entry.khz = block.khz;
+		entry.flags = !count || block.khz != khz ? REC_MARK_TUNE : 0;
+		fwrite(&entry, sizeof(entry), 1, out);
+
+		khz = block.khz;
+		count++;
+	}
+
+	/* a block cut in the middle, keep the recording appendable */
+	if (pos < (uint64_t)st.st_size) {
+		fprintf(stderr, "%s: %llu bytes cut at the end\n", path,
+				(unsigned long long)(st.st_size - pos));
+		if (ftruncate(fd, pos) < 0)
+			perror(path);
+	}
+
+	fclose(out);
+	close(fd);
+
+	return count;
+}
+
+/* map the index if it covers the whole recording, 0 on success */
+static int map_index(struct rec_reader *r, const char *path)
+{
+	struct stat st, data;
+	struct rec_block block;
+	char name[512];
+	int fd;
+
+	index_name(path, name, sizeof(name));
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || fstat(r->fd, &data) < 0 ||
+			st.st_size % sizeof(struct rec_index)) {
+		close(fd);
+		return -1;
+	}
+
+	r->count = st.st_size / sizeof(struct rec_index);
+	r->map_size = st.st_size;
+
+	if (!r->count) {
+		close(fd);
+		return data.st_size == sizeof(struct rec_header) ? 0 : -1;
+	}
+
+	r->index = mmap(NULL, r->map_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (r->index == MAP_FAILED) {
+		r->index = NULL;
+		return -1;
+	}
+
+	if (r->index[0].offset == sizeof(struct rec_header) &&
+			block_end(r->fd, &r->header, r->index[r->count - 1].offset, &block) ==
+			(uint64_t)data.st_size)
+		return 0;
+
+	munmap((void *)r->index, r->map_size);
+	r->index = NULL;
+	return -1;
+}
+
+int rec_open(struct rec_reader *r, const char *path)
+{
+	memset(r, 0, sizeof(*r));
+
+	r->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (r->fd < 0 || pread(r->fd, &r->header, sizeof(r->header), 0) != sizeof(r->header) ||
+			memcmp(r->header.magic, REC_MAGIC, sizeof(r->header.magic))) {
+		fprintf(stderr, "%s: not a recording\n", path);
+		rec_close(r);
+		return -1;
+	}
+
+	if (!map_index(r, path))
+		return 0;
+
+	printf("%s: indexing again\n", path);
+	if (rec_rebuild_index(path) < 0 || map_index(r, path) < 0) {
+		rec_close(r);
+		return -1;
+	}
+
+	return 0;
+}
+
+void rec_close(struct rec_reader *r)
+{
+	if (r->index)
+		munmap((void *)r->index, r->map_size);
+	if (r->fd >= 0)
+		close(r->fd);
+
+	r->index = NULL;
+	r->count = 0;
+	r->fd = -1;
+}
+
+size_t rec_find(const struct rec_reader *r, uint64_t ms)
+{
+	uint64_t when = r->header.start_ms + ms;
+	size_t lo = 0, hi = r->count;
+
+	/* the last block starting at or before when */
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (r->index[mid].time_ms <= when)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+int rec_read(const struct rec_reader *r, size_t pos, struct rec_block *block,
+		short *frames, uint32_t max_frames)
+{
+	struct iovec iov[2];
+	unsigned int frame_bytes = r->header.channels * 2;
+	ssize_t n;
+
+	if (pos >= r->count)
+		return -1;
+
+	iov[0].iov_base = block;
+	iov[0].iov_len = sizeof(*block);
+	iov[1].iov_base = frames;
+	iov[1].iov_len = (size_t)max_frames * frame_bytes;
+
+	n = preadv(r->fd, iov, 2, r->index[pos].offset);
+	if (n < (ssize_t)sizeof(*block) || block->magic != REC_BLOCK_MAGIC)
+		return -1;
+
+	n = (n - sizeof(*block)) / frame_bytes;
+	return n < block->frames ? n : block->frames;
+}
+
+/* copy len bytes between two files without bringing them to user space */
+static int copy_range(int in, off_t in_off, int out, off_t out_off, uint64_t len)
+{
+	static char buf[COPY_CHUNK];
+	ssize_t n;
+
+	while (len) {
+#ifdef __NR_copy_file_range
+		loff_t src = in_off, dst = out_off;
+
+		n = syscall(__NR_copy_file_range, in, &src, out, &dst, (size_t)len, 0);
+		if (n < 0 && errno != ENOSYS && errno != EXDEV && errno != EINVAL)
+			return -1;
+		if (n < 0)
+#endif
+		{
+			n = pread(in, buf, len < COPY_CHUNK ? len : COPY_CHUNK, in_off);
+			if (n > 0 && pwrite(out, buf, n, out_off) != n)
+				return -1;
+		}
+
+		if (n <= 0)
+			return -1;
+
+		in_off += n;
+		out_off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int rec_clip(const struct rec_reader *r, uint64_t from_ms, uint64_t to_ms,
+		const char *path)
+{
+	struct rec_header header = r->header;
+	struct rec_index entry;
+	struct stat st;
+	size_t first, last, i;
+	uint64_t start, end;
+	char name[512];
+	FILE *index;
+	int fd, ret = 0;
+
+	if (!r->count || to_ms <= from_ms || fstat(r->fd, &st) < 0)
+		return -1;
+
+	/* whole blocks, the one to_ms falls in included */
+	first = rec_find(r, from_ms);
+	last = rec_find(r, to_ms - 1) + 1;
+
+	start = r->index[first].offset;
+	end = last < r->count ? r->index[last].offset : (uint64_t)st.st_size;
+	header.start_ms = r->index[first].time_ms;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+
+	if (write(fd, &header, sizeof(header)) != sizeof(header) ||
+			copy_range(r->fd, start, fd, sizeof(header), end - start) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	/* the blocks did not change, only where they are */
+	index_name(path, name, sizeof(name));
+	index = fopen(name, "w");
+	if (!index)
+		return -1;
+
+	for (i = first; i < last; i++) {
+		entry = r->index[i];
+		entry.offset = entry.offset - start + sizeof(header);
+		if (i == first)
+			entry.flags |= REC_MARK_TUNE;
+		if (fwrite(&entry, sizeof(entry), 1, index) != 1)
+			ret = -1;
+	}
+
+	if (fclose(index))
+		ret = -1;
+
+	return ret;
+}
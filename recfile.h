@@ -0,0 +1,103 @@
+/*
+ * recfile.h - Recording container: the audio in one second blocks, and a
+ *             sidecar index to seek in it, shared by record.c and the tools
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define REC_MAGIC "RADIOREC"
+#define REC_BLOCK_MAGIC 0x4b4c4252     /* "RBLK" */
+
+/* the recording is name.rrec, its index name.rrec.idx */
+#define REC_SUFFIX ".rrec"
+#define REC_INDEX_SUFFIX ".idx"
+
+/* first block of a recording, or of a new frequency */
+#define REC_MARK_TUNE 1
+
+/* at the start of the recording */
+struct rec_header {
+	char magic[8];
+	uint32_t rate;
+	uint16_t channels;
+	uint16_t bits;
+	uint64_t start_ms;   /* wall clock time of the first frame */
+	uint32_t block_frames;
+	uint32_t reserved;
+};
+
+/* in front of the interleaved S16 frames of each block, so that the index
+ * can be rebuilt from the recording alone */
+struct rec_block {
+	uint32_t magic;
+	uint32_t frames;
+	uint64_t time_ms;    /* wall clock time of the first frame */
+	uint32_t khz;
+	uint32_t check;      /* of the fields above, see rec_block_check() */
+};
+
+/* the index file is an array of these, one per block, sorted by time */
+struct rec_index {
+	uint64_t offset;
+	uint64_t time_ms;
+	uint32_t khz;
+	uint32_t flags;
+};
+
+struct rec_writer {
+	int fd;
+	int index_fd;
+	uint64_t offset;
+	uint32_t khz;
+	uint16_t channels;
+};
+
+struct rec_reader {
+	int fd;
+	struct rec_header header;
+	const struct rec_index *index;
+	size_t count;
+	size_t map_size;
+};
+
+uint32_t rec_block_check(const struct rec_block *block);
+
+/* create path and its index, 0 on success */
+int rec_create(struct rec_writer *w, const char *path, uint32_t rate,
+		uint16_t channels, uint32_t block_frames, uint64_t start_ms);
+
+/* append a block made of the iov buffers, indexed, 0 on success */
+int rec_write_block(struct rec_writer *w, const struct iovec *iov, int iovcnt,
+		uint32_t frames, uint64_t time_ms, uint32_t khz);
+
+void rec_close_writer(struct rec_writer *w);
+
+/* Open a recording and map its index. An index that does not cover the
+ * whole recording is rebuilt first. 0 on success.
+ */
+int rec_open(struct rec_reader *r, const char *path);
+void rec_close(struct rec_reader *r);
+
+/* the block playing ms after the start of the recording */
+size_t rec_find(const struct rec_reader *r, uint64_t ms);
+
+/* read block pos with a single preadv, returns the frames read or -1 */
+int rec_read(const struct rec_reader *r, size_t pos, struct rec_block *block,
+		short *frames, uint32_t max_frames);
+
+/* copy the blocks from from_ms to to_ms to a new recording, as they are */
+int rec_clip(const struct rec_reader *r, uint64_t from_ms, uint64_t to_ms,
+		const char *path);
+
+/* Index a recording with one pass over it, dropping a block cut by a power
+ * loss at its end. Returns the number of blocks, or -1.
+ */
+long rec_rebuild_index(const char *path);
@@ -0,0 +1,225 @@
+/*
+ * record.c - Record the radio. The capture thread only copies to a ring,
+ *            a writer thread does the file I/O a block at a time, the SD
+ *            card can stall for longer than a capture period.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "capture.h"
+#include "data.h"
+#include "recfile.h"
+#include "record.h"
+
+#define RING_MASK (RECORD_RING_SIZE - 1)
+
+#define FRAME_BYTES (CAPTURE_CHANNELS * 2)
+
+#define BLOCK_BYTES (RECORD_BLOCK_FRAMES * FRAME_BYTES)
+
+static unsigned char ring[RECORD_RING_SIZE];
+static uint64_t head, tail;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+static int running;
+
+static struct rec_writer writer;
+static uint64_t start_ms;
+static uint64_t frames_done;     /* frames written, and dropped */
+static unsigned long dropped;
+
+/* frames dropped since the writer last caught up, and where in the ring */
+static uint64_t gap_at;
+static unsigned long gap_frames;
+static unsigned int khz;
+
+/* write one block straight from the ring, called without the lock;
+ * returns 0 when the block couldn't be written */
+static int write_block(uint64_t from, unsigned int bytes, uint64_t time_ms,
+		unsigned int block_khz)
+{
+	struct iovec iov[2];
+	unsigned int start = from & RING_MASK;
+	unsigned int first = RECORD_RING_SIZE - start;
+
+	if (first > bytes)
+		first = bytes;
+
+	iov[0].iov_base = ring + start;
+	iov[0].iov_len = first;
+	iov[1].iov_base = ring;
+	iov[1].iov_len = bytes - first;
+
+	return rec_write_block(&writer, iov, iov[1].iov_len ? 2 : 1, bytes / FRAME_BYTES,
+			time_ms, block_khz) == 0;
+}
+
+static void *record_thread(void *arg)
+{
+	unsigned int bytes, block_khz;
+	uint64_t from, time_ms;
+	int written;
+
+	pthread_mutex_lock(&lock);
+	while (running || head != tail) {
+		if (running && head - tail < BLOCK_BYTES) {
+			pthread_cond_wait(&ready, &lock);
+			continue;
+		}
+
+		/* blocks after a drop keep to the wall clock */
+		if (gap_frames && tail >= gap_at) {
+			frames_done += gap_frames;
+			gap_frames = 0;
+		}
+
+		/* the last block of a recording is shorter */
+		from = tail;
+		bytes = head - tail < BLOCK_BYTES ? head - tail : BLOCK_BYTES;
+		time_ms = start_ms + frames_done * 1000 / CAPTURE_RATE;
+		block_khz = khz;
+		pthread_mutex_unlock(&lock);
+
+		written = write_block(from, bytes, time_ms, block_khz);
+
+		pthread_mutex_lock(&lock);
+		tail += bytes;
+		frames_done += bytes / FRAME_BYTES;
+
+		/* the next blocks keep their time, this one is a gap */
+		if (!written)
+			dropped += bytes / FRAME_BYTES;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+/* capture thread */
+static void record_tap(const short *frames, unsigned int count, void *data)
+{
+	unsigned int bytes = count * FRAME_BYTES, start, first;
+
+	pthread_mutex_lock(&lock);
+
+	if (head - tail + bytes > RECORD_RING_SIZE) {
+		if (!gap_frames)
+			gap_at = head;
+		gap_frames += count;
+		dropped += count;
+	} else {
+		start = head & RING_MASK;
+		first = RECORD_RING_SIZE - start;
+		if (first > bytes)
+			first = bytes;
+
+		memcpy(ring + start, frames, first);
+		memcpy(ring, (const unsigned char *)frames + first, bytes - first);
+		head += bytes;
+
+		if (head - tail >= BLOCK_BYTES)
+			pthread_cond_signal(&ready);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+int record_start(float freq)
+{
+	char dir[255], name[320], stamp[32];
+	struct timeval tv;
+	time_t now;
+
+	if (running)
+		return 0;
+
+	gettimeofday(&tv, NULL);
+	now = tv.tv_sec;
+
+	data_file_path(RECORD_DIR, dir, sizeof(dir));
+	mkdir(dir, 0777);
+
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+	snprintf(name, sizeof(name), "%s/%s-%.1f%s", dir, stamp, freq, REC_SUFFIX);
+
+	start_ms = tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+	if (rec_create(&writer, name, CAPTURE_RATE, CAPTURE_CHANNELS,
+				RECORD_BLOCK_FRAMES, start_ms) < 0)
+		return -1;
+
+	if (capture_start() < 0) {
+		rec_close_writer(&writer);
+		return -1;
+	}
+
+	head = tail = 0;
+	frames_done = 0;
+	dropped = 0;
+	gap_frames = 0;
+	khz = freq * 1000 + 0.5f;
+
+	running = 1;
+	if (pthread_create(&thread, NULL, record_thread, NULL)) {
+		running = 0;
+		capture_stop();
+		rec_close_writer(&writer);
+		return -1;
+	}
+
+	capture_add_tap(record_tap, NULL);
+	printf("record: %s\n", name);
+
+	return 0;
+}
+
+void record_stop(void)
+{
+	if (!running)
+		return;
+
+	capture_remove_tap(record_tap, NULL);
+	capture_stop();
+
+	/* the writer empties the ring before it leaves */
+	pthread_mutex_lock(&lock);
+	running = 0;
+	pthread_cond_signal(&ready);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+
+	rec_close_writer(&writer);
+
+	printf("record: %llu s, %lu frames dropped\n",
+			(unsigned long long)(frames_done / CAPTURE_RATE), dropped);
+}
+
+void record_tune(float freq)
+{
+	pthread_mutex_lock(&lock);
+	khz = freq * 1000 + 0.5f;
+	pthread_mutex_unlock(&lock);
+}
+
+int record_running(void)
+{
+	return running;
+}
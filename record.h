@@ -0,0 +1,27 @@
+/*
+ * record.h - Record the radio, see recfile.h for the file format
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* ring between the capture thread and the writer, ~3 s of audio */
+#define RECORD_RING_SIZE (1 << 19)
+
+/* the writer wakes up for each block of this many frames, one second */
+#define RECORD_BLOCK_FRAMES 44100
+
+/* recordings go to ~/.radioplayer/RECORD_DIR */
+#define RECORD_DIR "recordings"
+
+/* start recording what is tuned, freq names the file, 0 on success */
+int record_start(float freq);
+void record_stop(void);
+
+/* the radio moved to freq, the next block is marked with it */
+void record_tune(float freq);
+
+int record_running(void);
@@ -0,0 +1,477 @@
+/*
+ * render.c - Offscreen 8bpp framebuffer. Colours are mapped once into a
+ *            palette LUT, fills and outlines are written a word at a time,
+ *            text is blitted from 1 bit masks, and only the damaged regions
+ *            are uploaded to the hardware surface at the end of a frame.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "render.h"
+
+struct region {
+	int x0, y0, x1, y1;  /* x1 and y1 are exclusive */
+};
+
+static uint8_t fb[FB_HEIGHT][FB_WIDTH] __attribute__((aligned(4)));
+
+static SDL_Surface *screen;
+
+/* palette index of every UI colour */
+static uint8_t lut[UI_NUM_COLORS];
+
+static const SDL_Color ui_rgb[UI_NUM_COLORS] = {
+	[UI_BLACK] = {0, 0, 0},
+	[UI_WHITE] = {255, 255, 255},
+	[UI_GREEN] = {0, 255, 0}
+};
+
+static struct region damage[RENDER_MAX_DAMAGE];
+static int num_damage;
+
+/* what the other buffer is missing when the screen is double buffered */
+static struct region prev_damage[RENDER_MAX_DAMAGE];
+static int num_prev_damage;
+
+/* whole factor the framebuffer is scaled by, and where it lands */
+static int scale = 1;
+static int origin_x, origin_y;
+
+/* the screen is off, see render_suspend() */
+static int suspended;
+
+/* text was skipped while suspended, repaint() draws it again on resume */
+static int text_skipped;
+static void (*repaint)(void);
+
+static struct {
+	unsigned long frames;
+	unsigned long pixels;
+	long ns;
+} stats;
+
+int render_init(SDL_Surface *surface)
+{
+	int i;
+
+	screen = surface;
+
+	if (screen->format->BitsPerPixel != 8) {
+		fprintf(stderr, "The renderer needs an 8bpp screen\n");
+		return -1;
+	}
+
+	for (i = 0; i < UI_NUM_COLORS; i++)
+		lut[i] = SDL_MapRGB(screen->format, ui_rgb[i].r, ui_rgb[i].g, ui_rgb[i].b);
+
+	scale = screen->w / FB_WIDTH < screen->h / FB_HEIGHT ?
+		screen->w / FB_WIDTH : screen->h / FB_HEIGHT;
+	if (scale < 1) {
+		fprintf(stderr, "The screen is smaller than the UI\n");
+		return -1;
+	}
+	if (scale > RENDER_MAX_SCALE)
+		scale = RENDER_MAX_SCALE;
+
+	/* scaled rows are written a word at a time */
+	origin_x = ((screen->w - FB_WIDTH * scale) / 2) & ~3;
+	origin_y = (screen->h - FB_HEIGHT * scale) / 2;
+
+	/* the border around a scaled UI is never drawn again */
+	if (scale > 1) {
+		SDL_FillRect(screen, NULL, lut[UI_BLACK]);
+		if (screen->flags & SDL_DOUBLEBUF) {
+			SDL_Flip(screen);
+			SDL_FillRect(screen, NULL, lut[UI_BLACK]);
+		}
+		printf("render: %dx%d scaled %dx on a %dx%d screen\n", FB_WIDTH, FB_HEIGHT,
+				scale, screen->w, screen->h);
+	}
+
+	memset(fb, lut[UI_BLACK], sizeof(fb));
+
+	/* the first frame goes up entirely */
+	num_damage = 1;
+	damage[0].x0 = damage[0].y0 = 0;
+	damage[0].x1 = FB_WIDTH;
+	damage[0].y1 = FB_HEIGHT;
+	num_prev_damage = 0;
+
+	return 0;
+}
+
+static int clip(const SDL_Rect *rect, struct region *r)
+{
+	r->x0 = rect->x < 0 ? 0 : rect->x;
+	r->y0 = rect->y < 0 ? 0 : rect->y;
+	r->x1 = rect->x + rect->w > FB_WIDTH ? FB_WIDTH : rect->x + rect->w;
+	r->y1 = rect->y + rect->h > FB_HEIGHT ? FB_HEIGHT : rect->y + rect->h;
+
+	return r->x0 < r->x1 && r->y0 < r->y1;
+}
+
+static void merge(struct region *a, const struct region *b)
+{
+	if (b->x0 < a->x0) a->x0 = b->x0;
+	if (b->y0 < a->y0) a->y0 = b->y0;
+	if (b->x1 > a->x1) a->x1 = b->x1;
+	if (b->y1 > a->y1) a->y1 = b->y1;
+}
+
+static int overlaps(const struct region *a, const struct region *b)
+{
+	return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+static void add_damage(struct region *list, int *count, const struct region *r)
+{
+	int i;
+
+	for (i = 0; i < *count; i++) {
+		if (overlaps(&list[i], r)) {
+			merge(&list[i], r);
+			return;
+		}
+	}
+
+	if (*count < RENDER_MAX_DAMAGE) {
+		list[(*count)++] = *r;
+		return;
+	}
+
+	/* out of slots, everything in one box */
+	for (i = 1; i < *count; i++)
+		merge(&list[0], &list[i]);
+	merge(&list[0], r);
+	*count = 1;
+}
+
+/* fill a span a word at a time, the row start is word aligned */
+static void span_fill(uint8_t *row, int x0, int x1, uint8_t index)
+{
+	uint32_t word = index * 0x01010101u;
+	uint32_t *w;
+
+	while (x0 < x1 && (x0 & 3))
+		row[x0++] = index;
+
+	for (w = (uint32_t *)(row + x0); x0 + 4 <= x1; x0 += 4)
+		*w++ = word;
+
+	while (x0 < x1)
+		row[x0++] = index;
+}
+
+void render_fill(const SDL_Rect *rect, int color)
+{
+	struct region r;
+	int y;
+
+	if (!clip(rect, &r))
+		return;
+
+	for (y = r.y0; y < r.y1; y++)
+		span_fill(fb[y], r.x0, r.x1, lut[color]);
+
+	add_damage(damage, &num_damage, &r);
+}
+
+void render_outline(const SDL_Rect *rect, int thickness, int color)
+{
+	SDL_Rect side;
+
+	/* top and bottom take the corners, the sides only what is left */
+	side.x = rect->x;
+	side.w = rect->w;
+	side.h = thickness;
+	side.y = rect->y;
+	render_fill(&side, color);
+	side.y = rect->y + rect->h - thickness;
+	render_fill(&side, color);
+
+	side.y = rect->y + thickness;
+	side.h = rect->h - 2 * thickness;
+	side.w = thickness;
+	side.x = rect->x;
+	render_fill(&side, color);
+	side.x = rect->x + rect->w - thickness;
+	render_fill(&side, color);
+}
+
+struct text_mask *render_text_mask(TTF_Font *font, const char *text)
+{
+	static const SDL_Color white = {255, 255, 255};
+	struct text_mask *mask;
+	SDL_Surface *s;
+	int x, y;
+
+	if (!font)
+		return NULL;
+
+	/* nobody would see it, rasterise it once the screen is back */
+	if (suspended) {
+		text_skipped = 1;
+		return NULL;
+	}
+
+	/* Solid rendering gives an 8 bit surface, 0 is the background */
+	s = TTF_RenderText_Solid(font, text, white);
+	if (!s)
+		return NULL;
+
+	mask = calloc(1, sizeof(*mask) + ((s->w + 31) / 32) * s->h * sizeof(uint32_t));
+	if (mask) {
+		mask->w = s->w;
+		mask->h = s->h;
+		mask->words = (s->w + 31) / 32;
+
+		SDL_LockSurface(s);
+		for (y = 0; y < s->h; y++) {
+			const uint8_t *src = (const uint8_t *)s->pixels + y * s->pitch;
+			uint32_t *dst = &mask->bits[y * mask->words];
+
+			for (x = 0; x < s->w; x++)
+				if (src[x])
+					dst[x >> 5] |= 1u << (x & 31);
+		}
+		SDL_UnlockSurface(s);
+	}
+
+	SDL_FreeSurface(s);
+
+	return mask;
+}
+
+void render_blit_mask(const struct text_mask *mask, int x, int y, int color)
+{
+	SDL_Rect rect = { x, y, mask->w, mask->h };
+	uint8_t index = lut[color];
+	struct region r;
+	int row, word;
+
+	if (!clip(&rect, &r))
+		return;
+
+	for (row = r.y0; row < r.y1; row++) {
+		const uint32_t *bits = &mask->bits[(row - y) * mask->words];
+		uint8_t *dst = fb[row] + x;
+
+		for (word = 0; word < mask->words; word++) {
+			uint32_t b = bits[word];
+
+			/* most words of a text row are empty */
+			while (b) {
+				int bit = __builtin_ctz(b);
+				int px = word * 32 + bit;
+
+				if (px + x >= r.x0 && px + x < r.x1)
+					dst[px] = index;
+				b &= b - 1;
+			}
+		}
+	}
+
+	add_damage(damage, &num_damage, &r);
+}
+
+void render_text(TTF_Font *font, const char *text, int x, int y, int color)
+{
+	struct text_mask *mask = render_text_mask(font, text);
+
+	if (mask) {
+		render_blit_mask(mask, x, y, color);
+		free(mask);
+	}
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PIXEL(w, i) (((w) >> (8 * (i))) & 0xff)
+#define PACK(a, b, c, d) ((a) | (b) << 8 | (c) << 16 | (uint32_t)(d) << 24)
+#else
+#define PIXEL(w, i) (((w) >> (24 - 8 * (i))) & 0xff)
+#define PACK(a, b, c, d) ((uint32_t)(a) << 24 | (b) << 16 | (c) << 8 | (d))
+#endif
+
+/* Each pixel twice: a word of four pixels becomes two words. Spreading the
+ * two halves with shifts and masks gives the same byte order on both
+ * endiannesses.
+ */
+static void scale2x_row(uint32_t *restrict dst, const uint32_t *restrict src, int words)
+{
+	int i;
+
+	for (i = 0; i < words; i++) {
+		uint32_t w = src[i];
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		uint32_t a = w & 0xffff, b = w >> 16;
+#else
+		uint32_t a = w >> 16, b = w & 0xffff;
+#endif
+
+		a = (a | a << 8) & 0x00ff00ff;
+		b = (b | b << 8) & 0x00ff00ff;
+		dst[2 * i] = a | a << 8;
+		dst[2 * i + 1] = b | b << 8;
+	}
+}
+
+/* each pixel three times: four pixels become three words */
+static void scale3x_row(uint32_t *restrict dst, const uint32_t *restrict src, int words)
+{
+	int i;
+
+	for (i = 0; i < words; i++) {
+		uint32_t w = src[i];
+		uint32_t p0 = PIXEL(w, 0), p1 = PIXEL(w, 1), p2 = PIXEL(w, 2), p3 = PIXEL(w, 3);
+
+		dst[3 * i] = PACK(p0, p0, p0, p1);
+		dst[3 * i + 1] = PACK(p1, p1, p2, p2);
+		dst[3 * i + 2] = PACK(p2, p3, p3, p3);
+	}
+}
+
+/* the screen rectangle a region of the framebuffer is shown in */
+static void screen_rect(const struct region *r, SDL_Rect *rect)
+{
+	int x0 = scale > 1 ? r->x0 & ~3 : r->x0;
+	int x1 = scale > 1 ? (r->x1 + 3) & ~3 : r->x1;
+
+	rect->x = origin_x + x0 * scale;
+	rect->y = origin_y + r->y0 * scale;
+	rect->w = (x1 - x0) * scale;
+	rect->h = (r->y1 - r->y0) * scale;
+}
+
+static unsigned long upload(const struct region *list, int count)
+{
+	unsigned long pixels = 0;
+	int i, y, k;
+
+	for (i = 0; i < count; i++) {
+		const struct region *r = &list[i];
+		SDL_Rect rect;
+		uint8_t *dst;
+
+		screen_rect(r, &rect);
+		dst = (uint8_t *)screen->pixels + rect.y * screen->pitch + rect.x;
+
+		for (y = r->y0; y < r->y1; y++, dst += scale * screen->pitch) {
+			const uint32_t *src = (const uint32_t *)(fb[y] + (r->x0 & ~3));
+
+			if (scale == 1) {
+				memcpy(dst, fb[y] + r->x0, rect.w);
+				continue;
+			}
+
+			/* widen one row, the other ones are copies of it */
+			if (scale == 2)
+				scale2x_row((uint32_t *)dst, src, rect.w / 8);
+			else
+				scale3x_row((uint32_t *)dst, src, rect.w / 12);
+
+			for (k = 1; k < scale; k++)
+				memcpy(dst + k * screen->pitch, dst, rect.w);
+		}
+
+		pixels += rect.w * rect.h;
+	}
+
+	return pixels;
+}
+
+void render_flush(void)
+{
+	struct region own[RENDER_MAX_DAMAGE];
+	struct timespec t0, t1;
+	unsigned long pixels;
+	int i, num_own = num_damage, double_buf = (screen->flags & SDL_DOUBLEBUF) != 0;
+
+	if (!num_damage || suspended)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	memcpy(own, damage, sizeof(damage));
+
+	/* the back buffer also misses what went to the other one last frame */
+	if (double_buf)
+		for (i = 0; i < num_prev_damage; i++)
+			add_damage(damage, &num_damage, &prev_damage[i]);
+
+	if (SDL_MUSTLOCK(screen))
+		SDL_LockSurface(screen);
+	pixels = upload(damage, num_damage);
+	if (SDL_MUSTLOCK(screen))
+		SDL_UnlockSurface(screen);
+
+	if (double_buf) {
+		SDL_Flip(screen);
+	} else {
+		SDL_Rect rects[RENDER_MAX_DAMAGE];
+
+		for (i = 0; i < num_damage; i++)
+			screen_rect(&damage[i], &rects[i]);
+		SDL_UpdateRects(screen, num_damage, rects);
+	}
+
+	memcpy(prev_damage, own, sizeof(own));
+	num_prev_damage = num_own;
+	num_damage = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	stats.frames++;
+	stats.pixels += pixels;
+	stats.ns += (t1.tv_sec - t0.tv_sec) * 1000000000L + t1.tv_nsec - t0.tv_nsec;
+
+	if (stats.frames == RENDER_STATS_FRAMES) {
+		printf("render: %lu px/frame, %.1f Mpx/s upload\n", stats.pixels / stats.frames,
+				stats.ns ? stats.pixels * 1000.0 / stats.ns : 0);
+		memset(&stats, 0, sizeof(stats));
+	}
+}
+
+void render_suspend(int on)
+{
+	if (on == suspended)
+		return;
+
+	suspended = on;
+	if (on)
+		return;
+
+	if (text_skipped && repaint)
+		repaint();
+	text_skipped = 0;
+
+	/* the panel may have lost what it showed, send it everything */
+	num_damage = 1;
+	damage[0].x0 = damage[0].y0 = 0;
+	damage[0].x1 = FB_WIDTH;
+	damage[0].y1 = FB_HEIGHT;
+
+	render_flush();
+}
+
+int render_suspended(void)
+{
+	return suspended;
+}
+
+void render_set_repaint(void (*fn)(void))
+{
+	repaint = fn;
+}
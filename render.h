@@ -0,0 +1,67 @@
+/*
+ * render.h - Offscreen 8bpp framebuffer where the whole UI is drawn
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdint.h>
+#include <SDL.h>
+#include <SDL/SDL_ttf.h>
+
+#define FB_WIDTH 320
+#define FB_HEIGHT 240
+
+/* regions uploaded at once before they are merged in a bounding box */
+#define RENDER_MAX_DAMAGE 16
+
+/* the UI is drawn at FB_WIDTH x FB_HEIGHT and scaled by a whole factor,
+ * up to this one, when the screen is bigger (TV out) */
+#define RENDER_MAX_SCALE 3
+
+/* print the upload throughput every this many frames */
+#define RENDER_STATS_FRAMES 128
+
+/* fixed colours of the UI, mapped to the screen palette at startup */
+enum ui_colors {
+	UI_BLACK,
+	UI_WHITE,
+	UI_GREEN,
+	UI_NUM_COLORS
+};
+
+/* 1 bit per pixel text, rows padded to 32 bits */
+struct text_mask {
+	int w, h;
+	int words;
+	uint32_t bits[];
+};
+
+/* screen can be bigger than the framebuffer, it is scaled and centred */
+int render_init(SDL_Surface *screen);
+
+void render_fill(const SDL_Rect *rect, int color);
+
+/* border of thickness pixels inside rect, inner pixels are not touched */
+void render_outline(const SDL_Rect *rect, int thickness, int color);
+
+struct text_mask *render_text_mask(TTF_Font *font, const char *text);
+void render_blit_mask(const struct text_mask *mask, int x, int y, int color);
+
+/* rasterise and draw text in one go */
+void render_text(TTF_Font *font, const char *text, int x, int y, int color);
+
+/* upload the damaged regions to the screen and show them */
+void render_flush(void);
+
+/* While suspended render_flush() uploads nothing, drawing only updates the
+ * framebuffer and text isn't rasterised at all. Resuming calls the repaint
+ * function when text was skipped, then repaints the whole screen from the
+ * framebuffer in one frame.
+ */
+void render_suspend(int on);
+int render_suspended(void);
+void render_set_repaint(void (*fn)(void));
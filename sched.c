@@ -0,0 +1,731 @@
+/*
+ * sched.c - Alarms, sleep timer and scheduled recordings. Every timer,
+ *           whatever their number, sits in a hierarchical timer wheel
+ *           driven by one timerfd armed at the next time something has
+ *           to happen, so adding, cancelling and firing a timer cost the
+ *           same with one entry or with hundreds.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "data.h"
+#include "events.h"
+#include "radio.h"
+#include "ramp.h"
+#include "record.h"
+#include "sched.h"
+
+#define SLOTS (1 << SCHED_WHEEL_BITS)
+#define SLOT_MASK (SLOTS - 1)
+
+/* seconds covered by one slot of a level */
+#define SPAN(level) ((time_t)1 << (SCHED_WHEEL_BITS * (level)))
+
+/* nothing is placed further away than this, see wheel_link() */
+#define HORIZON SPAN(SCHED_WHEEL_LEVELS)
+
+struct timer {
+	struct timer *next, **pprev;
+	time_t expires;
+	void (*fire)(struct timer *t);
+};
+
+struct slot {
+	struct sched_entry entry;
+	struct timer timer;
+	int used;
+};
+
+static struct timer *wheel[SCHED_WHEEL_LEVELS][SLOTS];
+static uint64_t occupied[SCHED_WHEEL_LEVELS];
+
+/* the first second whose slot has not run yet */
+static time_t next_tick;
+
+static struct slot slots[SCHED_MAX];
+
+static struct {
+	struct timer timer;
+	long from, to;
+	int step, steps;
+	void (*done)(void);
+	int active;
+	int handover;              /* it is for entry, see save() */
+	struct sched_entry entry;
+} fade;
+
+static struct timer record_timer;
+static struct sched_entry recording;
+
+/* what sched_stop() left in the saved schedule for the next process */
+static int handed_over;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int timer_fd = -1;
+static sched_notify notify;
+
+/* running as the background scheduler, see sched_daemon() */
+static int daemon_mode;
+static int radio_on;
+
+static void wheel_unlink(struct timer *t)
+{
+	if (!t->pprev)
+		return;
+
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+/* The level is picked by how far the timer is, the slot by its absolute
+ * time, so a slot of level l is cascaded to the lower levels exactly when
+ * the seconds below it wrap to 0. Timers already due go to the slot that
+ * runs next, timers beyond the horizon are parked at its end and linked
+ * again when they get there.
+ */
+static void wheel_link(struct timer *t)
+{
+	time_t when = t->expires, delta;
+	struct timer **head;
+	int level, slot;
+
+	if (when < next_tick)
+		when = next_tick;
+	if (when - next_tick >= HORIZON)
+		when = next_tick + HORIZON - 1;
+	delta = when - next_tick;
+
+	for (level = 0; level < SCHED_WHEEL_LEVELS - 1; level++)
+		if (delta < SPAN(level + 1))
+			break;
+
+	slot = (when >> (SCHED_WHEEL_BITS * level)) & SLOT_MASK;
+	head = &wheel[level][slot];
+
+	wheel_unlink(t);
+	t->next = *head;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = head;
+	*head = t;
+
+	occupied[level] |= 1ULL << slot;
+}
+
+/* Move the list of a slot to *list, which stands in for the slot head:
+ * the timers can still be unlinked from it while it is being walked.
+ */
+static void wheel_take(int level, int slot, struct timer **list)
+{
+	*list = wheel[level][slot];
+	if (*list)
+		(*list)->pprev = list;
+
+	wheel[level][slot] = NULL;
+	occupied[level] &= ~(1ULL << slot);
+}
+
+static void cascade(int level)
+{
+	struct timer *list;
+
+	wheel_take(level, (next_tick >> (SCHED_WHEEL_BITS * level)) & SLOT_MASK, &list);
+
+	while (list)
+		wheel_link(list);
+}
+
+/* run every second up to now, jumping over the ones with nothing to do */
+static void wheel_advance(time_t now)
+{
+	struct timer *list, *t;
+	int level;
+
+	while (next_tick <= now) {
+		if (!occupied[0] && (next_tick & SLOT_MASK)) {
+			next_tick = (next_tick | SLOT_MASK) + 1;
+			if (next_tick > now + 1)
+				next_tick = now + 1;
+			continue;
+		}
+
+		for (level = SCHED_WHEEL_LEVELS - 1; level > 0; level--)
+			if (!(next_tick & (SPAN(level) - 1)))
+				cascade(level);
+
+		wheel_take(0, next_tick & SLOT_MASK, &list);
+		next_tick++;
+
+		/* a timer may link itself again, or cancel one of the list */
+		while (list) {
+			t = list;
+			wheel_unlink(t);
+
+			if (t->expires >= next_tick)
+				wheel_link(t);
+			else
+				t->fire(t);
+		}
+	}
+}
+
+/* The second the wheel has to run next: the first busy slot of level 0,
+ * or the first cascade of a busy slot of an upper level. A slot of the
+ * current index of an upper level is only cascaded after a whole turn.
+ */
+static time_t wheel_next(void)
+{
+	time_t best = 0, block, when;
+	uint64_t bits;
+	int level, first, k;
+
+	for (level = 0; level < SCHED_WHEEL_LEVELS; level++) {
+		if (!occupied[level])
+			continue;
+
+		block = next_tick >> (SCHED_WHEEL_BITS * level);
+		first = (next_tick & (SPAN(level) - 1)) ? 1 : 0;
+
+		/* rotate so that bit 0 is the slot of the first block to come */
+		k = (block + first) & SLOT_MASK;
+		bits = k ? occupied[level] >> k | occupied[level] << (SLOTS - k) : occupied[level];
+
+		when = (block + first + __builtin_ctzll(bits)) << (SCHED_WHEEL_BITS * level);
+		if (!best || when < best)
+			best = when;
+	}
+
+	return best;
+}
+
+static void arm(void)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = wheel_next();
+
+	/* absolute wall clock time, a clock change wakes us up too */
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL);
+}
+
+static void schedule_at(struct timer *t, time_t when, void (*fire)(struct timer *t))
+{
+	t->expires = when;
+	t->fire = fire;
+	wheel_link(t);
+}
+
+/* the next run of a repeating entry, in local time so that 07:00 stays
+ * 07:00 across daylight saving changes */
+static time_t next_run(const struct sched_entry *e, time_t now)
+{
+	struct tm tm;
+	time_t when = e->at;
+
+	localtime_r(&e->at, &tm);
+	while (when <= now) {
+		tm.tm_mday += e->repeat_days;
+		tm.tm_isdst = -1;
+		when = mktime(&tm);
+	}
+
+	return when;
+}
+
+static void save(void)
+{
+	struct sched_entry table[SCHED_MAX + 2];
+	int i, count = 0;
+
+	for (i = 0; i < SCHED_MAX; i++)
+		if (slots[i].used)
+			table[count++] = slots[i].entry;
+
+	/* What is in progress is saved as a once entry from its start, so the
+	 * process that runs the schedule next finishes it, see sched_start().
+	 */
+	if (fade.active && fade.handover)
+		table[count++] = fade.entry;
+	if (record_timer.pprev)
+		table[count++] = recording;
+
+	handle_schedule(MODE_SET, table, &count);
+}
+
+static int pending(void)
+{
+	int i, count = 0;
+
+	for (i = 0; i < SCHED_MAX; i++)
+		count += slots[i].used;
+
+	return count;
+}
+
+static void fade_step(struct timer *t)
+{
+	fade.step++;
+	ramp_to(fade.from + (fade.to - fade.from) * fade.step / fade.steps, RAMP_MAX_MS);
+
+	if (fade.step < fade.steps) {
+		schedule_at(t, next_tick, fade_step);
+		return;
+	}
+
+	fade.active = 0;
+	if (fade.handover)
+		save();
+	if (fade.done)
+		fade.done();
+}
+
+/* entry is the alarm or the sleep timer the fade is for, NULL for none */
+static void start_fade(long target, int seconds, void (*done)(void),
+		const struct sched_entry *entry)
+{
+	int saved = fade.active && fade.handover;
+
+	wheel_unlink(&fade.timer);
+
+	fade.from = ramp_target();
+	fade.to = target;
+	fade.step = 0;
+	fade.steps = seconds > 0 ? seconds : 1;
+	fade.done = done;
+	fade.active = 1;
+	fade.handover = entry != NULL;
+
+	if (entry) {
+		fade.entry = *entry;
+		fade.entry.at = time(NULL);
+		fade.entry.seconds = fade.steps;
+		fade.entry.repeat_days = 0;
+		fade.entry.resumed = 0;
+	}
+
+	schedule_at(&fade.timer, next_tick, fade_step);
+
+	if (saved || fade.handover)
+		save();
+}
+
+static void record_done(struct timer *t)
+{
+	record_stop();
+	save();
+
+	/* the tuner was only woken up for the recording */
+	if (daemon_mode && !radio_on)
+		set_down();
+}
+
+static void start_record(float freq, int seconds)
+{
+	if (record_start(freq) < 0)
+		return;
+
+	memset(&recording, 0, sizeof(recording));
+	recording.type = SCHED_RECORD;
+	recording.at = time(NULL);
+	recording.freq = freq;
+	recording.seconds = seconds;
+
+	schedule_at(&record_timer, recording.at + seconds, record_done);
+	save();
+}
+
+/* the sleep timer of the background scheduler is over */
+static void radio_off(void)
+{
+	long level = 0;
+
+	set_down();
+	mixer_control(HEADPHONE_TURN_OFF, NULL, NULL, NULL);
+	mixer_control(SPEAKER_TURN_OFF, NULL, NULL, NULL);
+
+	/* nothing is routed now, give the level back to other apps */
+	handle_sound_level(FILE_VOLUME_READ, &level);
+	ramp_set(level);
+	radio_on = 0;
+}
+
+/* what the background scheduler does, the UI does it on its own */
+static void run(const struct sched_entry *e)
+{
+	long level = 0;
+	int mode = HEADPHONE_TURN_ON;
+	float freq = e->freq;
+
+	switch (e->type) {
+	case SCHED_ALARM:
+		handle_sound_level(FILE_VOLUME_READ, &level);
+		handle_mode(MODE_GET, &mode);
+
+		/* the UI left in the middle of the fade in, go on from there */
+		if (e->resumed && radio_on) {
+			start_fade(level, e->seconds, NULL, e);
+			break;
+		}
+
+		ramp_set(0);
+		setup(freq);
+		mixer_control(mode, NULL, NULL, NULL);
+		handle_user_freq(FILE_FREQ_WRITE, &freq);
+		radio_on = 1;
+
+		start_fade(level, e->seconds, NULL, e);
+		break;
+	case SCHED_SLEEP:
+		if (radio_on)
+			start_fade(0, e->seconds, radio_off, e);
+		break;
+	case SCHED_RECORD:
+		if (radio_on) {
+			set_frequency(freq);
+			handle_user_freq(FILE_FREQ_WRITE, &freq);
+		} else {
+			setup(freq);
+		}
+		start_record(e->freq, e->seconds);
+		break;
+	}
+}
+
+static void entry_fire(struct timer *t)
+{
+	struct slot *s = (struct slot *)((char *)t - offsetof(struct slot, timer));
+	struct sched_entry e = s->entry;
+
+	if (s->entry.repeat_days) {
+		s->entry.at = next_run(&s->entry, time(NULL));
+		schedule_at(t, s->entry.at, entry_fire);
+	} else {
+		s->used = 0;
+	}
+	save();
+
+	if (notify)
+		notify(&e);
+	else
+		run(&e);
+}
+
+/* called with the lock held */
+static int add(const struct sched_entry *entry)
+{
+	int i;
+
+	for (i = 0; i < SCHED_MAX; i++) {
+		if (slots[i].used)
+			continue;
+
+		slots[i].entry = *entry;
+		slots[i].used = 1;
+		schedule_at(&slots[i].timer, entry->at, entry_fire);
+		return 0;
+	}
+
+	fprintf(stderr, "The schedule is full\n");
+	return -1;
+}
+
+static void sched_tick(int fd, void *data)
+{
+	events_timer_ack(fd);
+
+	pthread_mutex_lock(&lock);
+	wheel_advance(time(NULL));
+	arm();
+
+	/* the background scheduler has nothing left to do */
+	if (daemon_mode && !pending() && !fade.active && !record_running())
+		kill(getpid(), SIGTERM);
+	pthread_mutex_unlock(&lock);
+}
+
+/* stop the scheduler left in background, it's us who run the schedule now */
+static void take_over(void)
+{
+	char name[255], self[PATH_MAX], exe[PATH_MAX], proc[32];
+	FILE *f;
+	int pid = 0, i;
+	ssize_t len;
+
+	data_file_path(SCHED_PID_FILE, name, sizeof(name));
+	f = fopen(name, "r");
+	if (!f)
+		return;
+	if (fscanf(f, "%d", &pid) != 1)
+		pid = 0;
+	fclose(f);
+
+	/* only if the pid is still one of us */
+	snprintf(proc, sizeof(proc), "/proc/%d/exe", pid);
+	len = readlink(proc, exe, sizeof(exe) - 1);
+	if (pid <= 0 || len < 0)
+		return;
+	exe[len] = '\0';
+
+	len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (len < 0)
+		return;
+	self[len] = '\0';
+
+	if (strcmp(exe, self) || kill(pid, SIGTERM) < 0)
+		return;
+
+	for (i = 0; i < 100 && !kill(pid, 0); i++)
+		usleep(10000);
+
+	printf("sched: took the schedule over from %d\n", pid);
+}
+
+int sched_start(sched_notify notify_cb)
+{
+	struct sched_entry table[SCHED_MAX + 2], e;
+	time_t now;
+	int i, count = SCHED_MAX + 2, resumed;
+
+	if (!daemon_mode)
+		take_over();
+
+	timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		perror("sched");
+		return -1;
+	}
+
+	handle_schedule(MODE_GET, table, &count);
+
+	pthread_mutex_lock(&lock);
+	notify = notify_cb;
+	now = time(NULL);
+	next_tick = now + 1;
+
+	for (i = 0; i < count; i++) {
+		e = table[i];
+
+		/* a recording or a fade still on, cut short when the last
+		 * process left, goes on for the rest of its time */
+		resumed = e.at <= now && e.at + e.seconds > now;
+		if (resumed) {
+			struct sched_entry rest = e;
+
+			rest.seconds -= now - e.at;
+			rest.at = now;
+			rest.repeat_days = 0;
+			rest.resumed = 1;
+			add(&rest);
+		}
+
+		if (e.at <= now && e.repeat_days) {
+			e.at = next_run(&e, now);
+		} else if (e.at <= now) {
+			if (!resumed)
+				printf("sched: dropped an entry missed at %ld\n", (long)e.at);
+			continue;
+		}
+
+		add(&e);
+	}
+
+	save();
+	arm();
+	pthread_mutex_unlock(&lock);
+
+	if (events_add(timer_fd, 0, sched_tick, NULL) < 0) {
+		close(timer_fd);
+		timer_fd = -1;
+		return -1;
+	}
+
+	printf("sched: %d entries\n", pending());
+	return 0;
+}
+
+void sched_stop(int handover)
+{
+	if (timer_fd < 0)
+		return;
+
+	events_remove(timer_fd);
+	close(timer_fd);
+	timer_fd = -1;
+
+	pthread_mutex_lock(&lock);
+	if (!handover && fade.active && fade.handover) {
+		fade.active = 0;
+		save();
+	}
+
+	/* still in the saved schedule, the next process goes on with them */
+	handed_over = (fade.active && fade.handover) + (record_timer.pprev != NULL);
+
+	wheel_unlink(&fade.timer);
+	fade.active = 0;
+	wheel_unlink(&record_timer);
+	pthread_mutex_unlock(&lock);
+
+	record_stop();
+}
+
+int sched_add(const struct sched_entry *entry)
+{
+	int ret;
+
+	pthread_mutex_lock(&lock);
+	ret = add(entry);
+	if (!ret) {
+		save();
+		arm();
+	}
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+void sched_cancel(int type)
+{
+	int i;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < SCHED_MAX; i++) {
+		if (slots[i].used && slots[i].entry.type == type) {
+			wheel_unlink(&slots[i].timer);
+			slots[i].used = 0;
+		}
+	}
+	save();
+	if (timer_fd >= 0)
+		arm();
+	pthread_mutex_unlock(&lock);
+}
+
+int sched_next(int type, struct sched_entry *entry)
+{
+	int i, found = 0;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < SCHED_MAX; i++) {
+		const struct sched_entry *e = &slots[i].entry;
+
+		if (!slots[i].used || (type >= 0 && e->type != type))
+			continue;
+		if (!found || e->at < entry->at)
+			*entry = *e;
+		found = 1;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return found;
+}
+
+void sched_fade(long target, int seconds, void (*done)(void),
+		const struct sched_entry *entry)
+{
+	pthread_mutex_lock(&lock);
+	start_fade(target, seconds, done, entry);
+	arm();
+	pthread_mutex_unlock(&lock);
+}
+
+void sched_record(float freq, int seconds)
+{
+	pthread_mutex_lock(&lock);
+	start_record(freq, seconds);
+	arm();
+	pthread_mutex_unlock(&lock);
+}
+
+void sched_detach(void)
+{
+	pid_t pid;
+
+	if (!pending() && !handed_over)
+		return;
+
+	/* only async signal safe calls between fork and exec, we have threads */
+	pid = fork();
+	if (pid < 0) {
+		perror("sched: fork");
+		return;
+	}
+
+	if (!pid) {
+		setsid();
+		execl("/proc/self/exe", "radio", SCHED_ARG, (char *)NULL);
+		_exit(1);
+	}
+
+	printf("sched: %d entries left to process %d\n", pending() + handed_over, pid);
+}
+
+int sched_daemon(void)
+{
+	char name[255];
+	sigset_t set;
+	long level, min, max, bypass = 0;
+	FILE *f;
+	int sig;
+
+	/* every thread started from now on inherits the mask, see sigwait */
+	sigemptyset(&set);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	daemon_mode = 1;
+	init_controls();
+
+	if (events_start() < 0)
+		return 1;
+
+	mixer_control(VOLUME_GET, &level, &min, &max);
+	ramp_init(level);
+
+	/* the radio is still playing if the UI was left to background */
+	mixer_control(BYPASS_VERIFICATION, &bypass, NULL, NULL);
+	radio_on = bypass != 0;
+
+	data_file_path(SCHED_PID_FILE, name, sizeof(name));
+	f = fopen(name, "w");
+	if (f) {
+		fprintf(f, "%d\n", getpid());
+		fclose(f);
+	}
+
+	if (!sched_start(NULL) && pending())
+		sigwait(&set, &sig);
+
+	/* the UI took over, it finishes what is in progress */
+	sched_stop(1);
+	events_stop();
+	unlink(name);
+
+	return 0;
+}
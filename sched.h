@@ -0,0 +1,80 @@
+/*
+ * sched.h - Alarms, sleep timer and scheduled recordings
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <time.h>
+
+#define SCHED_MAX 32
+
+/* timer wheel: 1 s ticks, 64 slots per level, 64^4 s (~194 days) ahead */
+#define SCHED_WHEEL_BITS 6
+#define SCHED_WHEEL_LEVELS 4
+
+/* sleep timer key steps, in minutes */
+#define SCHED_SLEEP_STEPS { 15, 30, 60, 90 }
+#define SCHED_SLEEP_FADE_S 30
+
+/* argument that starts the program as the background scheduler */
+#define SCHED_ARG "--schedule"
+
+/* pid of the scheduler left running when the UI goes to background */
+#define SCHED_PID_FILE "schedule.pid"
+
+enum sched_types {
+	SCHED_ALARM,         /* tune freq and fade in over seconds */
+	SCHED_SLEEP,         /* fade out over seconds and turn the radio off */
+	SCHED_RECORD         /* record freq for seconds */
+};
+
+struct sched_entry {
+	int type;
+	time_t at;           /* next run, seconds since the epoch */
+	int repeat_days;     /* 0 runs once, 1 every day, 7 every week */
+	float freq;          /* MHz, alarms and recordings */
+	int seconds;
+	int resumed;         /* the rest of one cut short, not saved */
+};
+
+/* called from the event thread when an entry runs, after its action */
+typedef void (*sched_notify)(const struct sched_entry *entry);
+
+/* Load the schedule and run it, taking it over from a scheduler left in
+ * background. Needs the event thread and the volume ramp.
+ */
+int sched_start(sched_notify notify);
+
+/* A recording in progress stays in the saved schedule for the process that
+ * runs it next, so does the fade of an alarm or sleep timer with handover.
+ */
+void sched_stop(int handover);
+
+/* add an entry and save the schedule, 0 on success */
+int sched_add(const struct sched_entry *entry);
+
+/* drop every entry of a type and save the schedule */
+void sched_cancel(int type);
+
+/* the entry of type (-1 for any) that runs first, 0 when there is none */
+int sched_next(int type, struct sched_entry *entry);
+
+/* fade the volume to target over seconds, done runs in the event thread;
+ * entry is the alarm or sleep timer it is for, or NULL */
+void sched_fade(long target, int seconds, void (*done)(void),
+		const struct sched_entry *entry);
+
+/* record what is tuned for seconds, freq names the file */
+void sched_record(float freq, int seconds);
+
+/* Leave a scheduler process running the schedule when the UI exits to
+ * background. Nothing is started when the schedule is empty.
+ */
+void sched_detach(void);
+
+/* main of that process (radio --schedule), returns the exit status */
+int sched_daemon(void);
@@ -17,10 +17,27 @@
 #include <SDL.h>
 #include <SDL/SDL_ttf.h>
 #include <signal.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include "radio.h"
 #include "data.h"
+#include "dial.h"
+#include "dsp.h"
+#include "events.h"
+#include "fingerprint.h"
+#include "fphash.h"
+#include "loudness.h"
+#include "meter.h"
+#include "power.h"
+#include "ramp.h"
+#include "record.h"
+#include "render.h"
+#include "sched.h"
+#include "state.h"
+#include "stream.h"
+#include "trace.h"
+#include "tuner.h"
 
 #define WIDTH 320
 #define HEIGHT 240
@@ -35,22 +52,15 @@
 
 /* All rectangles of volume control */
 SDL_Rect rects[32];
-int colors[32][3];
 
 TTF_Font *freq_font = NULL;
-SDL_Surface *freq_info = NULL;
-
 TTF_Font *shortcut_font = NULL;
-SDL_Surface *shortcut_info = NULL;
-
 TTF_Font *seek_mode_font = NULL;
-SDL_Surface *seek_mode_info = NULL;
-
 TTF_Font *fav_rad_font = NULL;
-SDL_Surface *fav_rad_info = NULL;
-
 TTF_Font *desc_fav_rad_font = NULL;
-SDL_Surface *desc_fav_rad_info = NULL;
+
+/* text that never changes is rasterised once */
+static struct text_mask *seek_mode_masks[2];
 
 SDL_Surface *screen;
 
@@ -59,17 +69,25 @@ SDL_Surface *screen;
  */
 int end_application = 1;
 
-/* Default seek mode is auto */
-int seek_mode = SEEK_AUTO;
+/* the range of the mixer, the radio state is in state.h */
+static long min, max;
+
+/* a seek runs in its own thread, the UI keeps drawing meanwhile */
+static float seek_result, seek_db;
 
-/* Current fav radio selected */
-int curr_fav = 0;
+/* the sleep timer is fading the radio out */
+static int sleeping;
 
-/* currect frequency */
-float curr_freq = 0;
+/* an entry of the schedule handed to the main loop */
+struct due {
+	struct sched_entry entry;
+	struct due *next;
+};
 
-/* Font color used in all text rendered */
-static SDL_Color font_color = {255, 255, 255};
+/* the ones due during a seek, in order, run once it is over */
+static struct due *deferred, **deferred_tail = &deferred;
+
+static void run_entry(const struct sched_entry *e);
 
 /* All rects to show favorite radios */
 static SDL_Rect favrad_rects[5] = {
@@ -88,27 +106,12 @@ static SDL_Rect favrad_rects_border[5] = {
 					{.x = 232, .y = 32, .w = 46, .h = 26}
 };
 
-/* blit to the screen */
-void apply_surface(int x, int y, SDL_Surface *font, SDL_Surface *screen)
-{
-	SDL_Rect tmp;
-
-	tmp.x = x;
-	tmp.y = y;
-
-	SDL_BlitSurface(font, NULL, screen, &tmp);
-	SDL_Flip(screen);
-}
-
-/* Initial position of each rectangle and init the colors */
+/* Initial position of each rectangle */
 void setup_volume_bar()
 {
 	int i, ypos = HEIGHT - 5;
 
 	for (i = 0; i < 32; i++) {
-		colors[i][0] = colors[i][2] = 0;
-		colors[i][1] = 255;
-
 		rects[i].x = VOLUME_BAR_X_POS;
 		rects[i].y = ypos;
 		rects[i].w = VOLUME_RECT_WIDTH;
@@ -119,41 +122,78 @@ void setup_volume_bar()
 }
 
 /* draw the volume bar */
-void draw_volume_bar(SDL_Surface *screen, int vol, int mode)
+void draw_volume_bar(int vol, int mode)
 {
 	int i = 0;
 
-	Uint32 color = SDL_MapRGB(screen->format, colors[vol][0], colors[vol][1], colors[vol][2]);
-
 	switch (mode) {
 	case STARTUP:
 		while (i <= vol) {
-			SDL_FillRect(screen, &rects[i], color);
+			render_fill(&rects[i], UI_GREEN);
 			i++;
 		}
 		break;
 	case VOLUME_DOWN:
-		color = SDL_MapRGB(screen->format, 0, 0, 0);
-		SDL_FillRect(screen, &rects[vol], color);
+		render_fill(&rects[vol], UI_BLACK);
 		break;
 	case VOLUME_UP:
-		SDL_FillRect(screen, &rects[vol], color);
+		render_fill(&rects[vol], UI_GREEN);
 	}
+}
 
-	SDL_Flip(screen);
+/* the mixer level for the user volume on this station */
+static long station_level(void)
+{
+	return mixer_volume_offset(radio.volume, radio.station_db);
 }
 
 /* free all allocated memory and structs ant turn off the radio */
 static void finish_app()
 {
+	set_seek_verify(0);
+	stream_stop();
+	loudness_stop();
+	fingerprint_stop();
+
+	/* there is nothing to put to sleep once the radio is off */
+	if (end_application)
+		sched_cancel(SCHED_SLEEP);
+
+	/* a fade in or out goes on in background, not once the radio is off */
+	sched_stop(!end_application);
+
 	if (end_application) {
+		/* not the ramp target, a sleep timer may have faded it to 0 */
+		long level = station_level();
+
+		ramp_to(0, RAMP_OUT_MS);
+		ramp_wait();
+
 		set_down();
 
 		/* Turn off all modes */
 		mixer_control(HEADPHONE_TURN_OFF, NULL, NULL, NULL);
 		mixer_control(SPEAKER_TURN_OFF, NULL, NULL, NULL);
+
+		/* nothing is routed now, give the level back to other apps */
+		ramp_set(level);
+		dsp_stop();
+	} else if (dsp_running()) {
+		/* the DSP path dies with us, play through the bypass */
+		long level = ramp_target();
+
+		ramp_to(0, RAMP_OUT_MS);
+		ramp_wait();
+		dsp_stop();
+		mixer_software_path(0);
+		mixer_control(radio.mode, NULL, NULL, NULL);
+		ramp_to(level, RAMP_IN_MS);
+		ramp_wait();
 	}
 
+	events_stop();
+	power_exit();
+
 	TTF_CloseFont(freq_font);
 	TTF_CloseFont(shortcut_font);
 	TTF_CloseFont(seek_mode_font);
@@ -162,6 +202,9 @@ static void finish_app()
 	TTF_Quit();
 	SDL_Quit();
 
+	/* alarms and recordings go on without the UI */
+	sched_detach();
+
 	exit(0);
 }
 
@@ -184,30 +227,36 @@ void load_ttf_font()
 	fav_rad_font = TTF_OpenFont("Fiery_Turk.ttf", 10);
 	desc_fav_rad_font = TTF_OpenFont("Fiery_Turk.ttf", 10);
 
+	seek_mode_masks[0] = render_text_mask(seek_mode_font, "Seek automatic");
+	seek_mode_masks[1] = render_text_mask(seek_mode_font, "Seek manual");
+
 	/* put all available shortcuts in the screen */
 	if (!shortcut_font)
 		fprintf(stderr, "Cannot find ttf Turk/6!\n");
 	else {
-		SDL_Color color = {255, 255, 255};
-
 		char *message = "Up: Vol+ | Down: Vol- | L: Seek Prv | R: Seek Next | Sel+Start: Exit";
-		shortcut_info = TTF_RenderText_Solid(shortcut_font, message, color);
-		apply_surface(0, 190, shortcut_info, screen);
+		render_text(shortcut_font, message, 0, 190, UI_WHITE);
 
 		message = "B: Run in background | Y: Switch between Headphone or Speakers";
-		shortcut_info = TTF_RenderText_Solid(shortcut_font, message, color);
-		apply_surface(0, 200, shortcut_info, screen);
+		render_text(shortcut_font, message, 0, 200, UI_WHITE);
 
 		message = "Start: Change seek mode | X: Add favo radio | A: Rem favo radio";
-		shortcut_info = TTF_RenderText_Solid(shortcut_font, message, color);
-		apply_surface(0, 210, shortcut_info, screen);
+		render_text(shortcut_font, message, 0, 210, UI_WHITE);
+
+		message = "Select: Set favorite radio to play | Sel+X: Scan to favorites";
+		render_text(shortcut_font, message, 0, 220, UI_WHITE);
 
-		message = "Select: Set favorite radio to play";
-		shortcut_info = TTF_RenderText_Solid(shortcut_font, message, color);
-		apply_surface(0, 220, shortcut_info, screen);
+		message = "Sel+A: Sleep timer";
+		render_text(shortcut_font, message, 0, 230, UI_WHITE);
 	}
 }
 
+/* a frequency as the UI shows it, the 30 kHz OIRT raster needs hundredths */
+static void freq_text(char *out, int size, float freq)
+{
+	snprintf(out, size, band_active()->step_khz % 100 ? "%.2f" : "%.1f", freq);
+}
+
 /* Show to user what is the current frequency */
 void print_freq(float freq, int searching)
 {
@@ -220,110 +269,454 @@ void print_freq(float freq, int searching)
 		tmp_rect.y = 100;
 		tmp_rect.w = 200;
 		tmp_rect.h = 50;
-	
-		Uint32 color = SDL_MapRGB(screen->format, 0, 0, 0);
-		SDL_FillRect(screen, &tmp_rect, color);
+
+		render_fill(&tmp_rect, UI_BLACK);
 
 		int line = 138;
 		char freq_char[13];
 
-		sprintf(freq_char, "%.1f", freq);
+		freq_text(freq_char, sizeof(freq_char), freq);
 
 		if (searching) {
 			line = 80;
 			strcpy(freq_char, "Searching...");
 		}
 
-		freq_info = TTF_RenderText_Solid(freq_font, freq_char, font_color);
-	
-		apply_surface(line, (HEIGHT - 28) / 2, freq_info, screen);
+		render_text(freq_font, freq_char, line, (HEIGHT - 28) / 2, UI_WHITE);
+	}
+
+	/* the song playing, under the frequency */
+	if (shortcut_font && !searching) {
+		char title[FP_TITLE_LEN];
+		int len, w, h;
+
+		fingerprint_title(title, sizeof(title));
+
+		/* cut it to the width of the frequency area */
+		for (len = strlen(title); len > 0; title[--len] = '\0')
+			if (!TTF_SizeText(shortcut_font, title, &w, &h) && w <= 200)
+				break;
+
+		if (len)
+			render_text(shortcut_font, title, 80, 140, UI_WHITE);
 	}
 }
 
-/* Show frequency when seek mode is manual */
+/* Tune to a new frequency with a short fade around it */
+static void tune(float freq)
+{
+	ramp_to(0, RAMP_OUT_MS);
+	ramp_wait();
+	set_frequency(freq);
+	fingerprint_retune();
+	record_tune(freq);
+	radio.station_db = loudness_tune(freq);
+	ramp_to(station_level(), RAMP_IN_MS);
+	meter_retune();
+}
+
+/* Seek with the audio faded out, the tuner is noisy between stations. It
+ * runs in the seek thread, the UI takes seek_db with the station found. */
+static float seek(int mode)
+{
+	struct radio_state now;
+	float freq;
+
+	ramp_to(0, RAMP_OUT_MS);
+	ramp_wait();
+
+	/* nothing heard during the seek belongs to a station */
+	loudness_tune(0);
+	fingerprint_retune();
+	freq = seek_radio_station(mode);
+	fingerprint_retune();
+	seek_db = loudness_tune(freq);
+
+	/* the UI ignores the volume keys during the seek, but another
+	 * application may have changed the volume meanwhile */
+	state_read(&now);
+	ramp_to(mixer_volume_offset(now.volume, seek_db), RAMP_IN_MS);
+
+	return freq;
+}
+
+/* Show frequency when seek mode is manual, one channel of the band plan
+ * at a time, wrapping at the ends of the band */
 static void get_next_frequency(int seek_type)
 {
-	if (seek_type == SEEK_UP) {
-		curr_freq += .10;
-		if (curr_freq > 108.0)
-			curr_freq = 78.0;
-	} else if (seek_type == SEEK_DOWN) {
-		curr_freq -= .10;
-		if (curr_freq < 76.5)
-			curr_freq = 108.0;
-	}
+	unsigned int step = band_active()->step_khz, lo, hi;
+	unsigned int khz = band_snap(radio.freq * 1000 + 0.5f);
+
+	band_range(&lo, &hi);
+
+	if (seek_type == SEEK_UP)
+		khz = khz + step > hi ? lo : khz + step;
+	else if (seek_type == SEEK_DOWN)
+		khz = khz < lo + step ? hi : khz - step;
+
+	radio.freq = khz / 1000.0f;
 }
 
-/* To be able to draw borders, we need to draw a bigger rect, and after a small one
- * filled by black color */
+/* Draw the border of each favorite and clear what is inside it, each pixel
+ * is written once */
 static void draw_favrads_rects()
 {
-	Uint32 black_color = SDL_MapRGB(screen->format, 0, 0, 0);
-	Uint32 green_color = SDL_MapRGB(screen->format, 0, 255, 0);
-	Uint32 white_color = SDL_MapRGB(screen->format, 255, 255, 255);
-
 	int i = 0;
 
 	for (i = 0; i < 5; i++) {
 		/* Selected favorite radio has green border */
-		if (i == curr_fav)
-			SDL_FillRect(screen, &favrad_rects[i], green_color);
-		else
-			SDL_FillRect(screen, &favrad_rects[i], white_color);
+		render_outline(&favrad_rects[i], favrad_rects_border[i].x - favrad_rects[i].x,
+				i == radio.fav ? UI_GREEN : UI_WHITE);
 
-		SDL_FillRect(screen, &favrad_rects_border[i], black_color);
+		render_fill(&favrad_rects_border[i], UI_BLACK);
 
-		printf("Radio %s\n", favrads.radio[i]);
+		printf("Radio %s\n", radio.favrads.radio[i]);
 
-		int freq_size = strlen(favrads.radio[i]);
+		int freq_size = strlen(radio.favrads.radio[i]);
 
 		char freq[6];
 
 		if (freq_size == 1)
 			strcpy(freq, "-");
 		else
-			strcpy(freq, favrads.radio[i]);
+			strcpy(freq, radio.favrads.radio[i]);
 
 		/* Draw favorite radio into rect */
-		desc_fav_rad_info = TTF_RenderText_Solid(desc_fav_rad_font, freq, font_color);
-		apply_surface(favrad_rects[i].x + 10, 35, desc_fav_rad_info, screen);
+		render_text(desc_fav_rad_font, freq, favrad_rects[i].x + 10, 35, UI_WHITE);
 	}
-	SDL_Flip(screen);
 }
 
 static void draw_favrads_label()
 {
-	fav_rad_info = TTF_RenderText_Solid(fav_rad_font, "Favorite Radios", font_color);
-	apply_surface(0, 0, fav_rad_info, screen);
+	render_text(fav_rad_font, "Favorite Radios", 0, 0, UI_WHITE);
+}
+
+/* Fill the empty favorite slots with the strongest stations of the band */
+static void scan_favorites()
+{
+	float stations[5];
+	char char_freq[6];
+	long level = ramp_target();
+	int i, j, next = 0, count;
+
+	/* show what is on the way before blocking */
+	render_flush();
+
+	/* the listening tuner takes part in the scan */
+	ramp_to(0, RAMP_OUT_MS);
+	ramp_wait();
+	count = scan_band(stations, 5);
+	ramp_to(level, RAMP_IN_MS);
+
+	for (i = 0; i < 5 && next < count; i++) {
+		if (strlen(radio.favrads.radio[i]) > 1)
+			continue;
+
+		/* don't add a station twice */
+		for (; next < count; next++) {
+			freq_text(char_freq, sizeof(char_freq), stations[next]);
+			for (j = 0; j < 5 && strcmp(radio.favrads.radio[j], char_freq); j++)
+				;
+			if (j == 5)
+				break;
+		}
+
+		if (next < count) {
+			handle_fav_radios(FILE_FAVRAD_WRITE, &radio.favrads, char_freq, i);
+			next++;
+		}
+	}
 }
 
 /* Show the seek mode in the screen */
 static void show_seek_mode()
 {
-	char smode[20];
+	struct text_mask *smode;
 	int pos;
 
-	if (seek_mode == SEEK_MANUAL) {
-		strcpy(smode, "Seek manual");
+	if (radio.seek_mode == SEEK_MANUAL) {
+		smode = seek_mode_masks[1];
 		pos = 123;
 	} else {
-		strcpy(smode, "Seek automatic");
+		smode = seek_mode_masks[0];
 		pos = 113;
 	}
 
 	/* Remove the old seek mode from the screen */
 	SDL_Rect tmp_rect;
-	Uint32 color = SDL_MapRGB(screen->format, 0, 0, 0);
 
 	tmp_rect.x = 100;
 	tmp_rect.y = 150;
 	tmp_rect.w = 140;
 	tmp_rect.h = 40;
 
-	SDL_FillRect(screen, &tmp_rect, color);
+	render_fill(&tmp_rect, UI_BLACK);
+
+	if (smode)
+		render_blit_mask(smode, pos, 150, UI_WHITE);
+}
+
+static void *seek_thread(void *data)
+{
+	SDL_Event event;
+
+	seek_result = seek((long)data);
+
+	memset(&event, 0, sizeof(event));
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_SEEK_DONE;
+	SDL_PushEvent(&event);
+
+	return NULL;
+}
+
+/* the seek is over, radio.freq is the station found */
+static void seek_done(void)
+{
+	struct due *d;
+
+	radio.seeking = 0;
+	radio.station_db = seek_db;
+	dial_seek(0);
+	meter_hold(METER_HOLD_SEEK, 0);
+	record_tune(radio.freq);
+	dial_set(radio.freq);
+	print_freq(radio.freq, 0);
+	show_seek_mode();
+	handle_user_freq(FILE_FREQ_WRITE, &radio.freq);
+
+	while (deferred) {
+		d = deferred;
+		deferred = d->next;
+		run_entry(&d->entry);
+		free(d);
+	}
+	deferred_tail = &deferred;
+}
+
+/* Start a seek and let the dial follow it, the main loop gets
+ * EVENT_SEEK_DONE when it is over */
+static void start_seek(int mode)
+{
+	pthread_t thread;
+
+	print_freq(radio.freq, 1);
+	render_flush();
+
+	if (pthread_create(&thread, NULL, seek_thread, (void *)(long)mode)) {
+		/* no thread, block as we used to */
+		radio.freq = seek(mode);
+		seek_done();
+		return;
+	}
+
+	pthread_detach(thread);
+	radio.seeking = 1;
+	meter_hold(METER_HOLD_SEEK, 1);
+	dial_seek(mode == SEEK_UP ? 1 : -1);
+}
+
+/* the next entry of the schedule, next to the favorites label */
+static void show_schedule(void)
+{
+	static const char *names[] = { "Alarm", "Sleep", "Rec" };
+	struct sched_entry e;
+	SDL_Rect tmp_rect;
+	char label[32];
+	struct tm tm;
+
+	tmp_rect.x = 100;
+	tmp_rect.y = 0;
+	tmp_rect.w = 130;
+	tmp_rect.h = 14;
+
+	render_fill(&tmp_rect, UI_BLACK);
+
+	if (!shortcut_font || !sched_next(-1, &e))
+		return;
+
+	localtime_r(&e.at, &tm);
+	sprintf(label, "%s %02d:%02d", names[e.type], tm.tm_hour, tm.tm_min);
+	render_text(shortcut_font, label, 110, 4, UI_WHITE);
+}
+
+/* Select + A: no sleep timer, then each of SCHED_SLEEP_STEPS, then none */
+static void cycle_sleep_timer(void)
+{
+	static const int steps[] = SCHED_SLEEP_STEPS;
+	static int step = -1;
+	struct sched_entry e;
+
+	/* it went off since the last key */
+	if (!sched_next(SCHED_SLEEP, &e))
+		step = -1;
+
+	sched_cancel(SCHED_SLEEP);
+
+	/* the key also stops a fade out in progress */
+	if (sleeping) {
+		sleeping = 0;
+		step = -1;
+		sched_fade(station_level(), 1, NULL, NULL);
+	}
+
+	if (++step >= (int)(sizeof(steps) / sizeof(steps[0]))) {
+		step = -1;
+		printf("Sleep timer off\n");
+	} else {
+		memset(&e, 0, sizeof(e));
+		e.type = SCHED_SLEEP;
+		e.at = time(NULL) + steps[step] * 60;
+		e.seconds = SCHED_SLEEP_FADE_S;
+		sched_add(&e);
+		printf("Sleep timer: %d minutes\n", steps[step]);
+	}
+
+	show_schedule();
+}
+
+/* event thread: the sleep timer faded the radio out */
+static void sleep_done(void)
+{
+	SDL_Event event;
+
+	memset(&event, 0, sizeof(event));
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_SLEEP;
+	SDL_PushEvent(&event);
+}
+
+/* event thread: hand the entry due to the main loop */
+static void schedule_notify(const struct sched_entry *entry)
+{
+	struct due *copy = malloc(sizeof(*copy));
+	SDL_Event event;
+
+	if (!copy)
+		return;
+	copy->entry = *entry;
+	copy->next = NULL;
+
+	memset(&event, 0, sizeof(event));
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_SCHEDULE;
+	event.user.data1 = copy;
+	SDL_PushEvent(&event);
+}
 
-	seek_mode_info = TTF_RenderText_Solid(seek_mode_font, smode, font_color);
-	apply_surface(pos, 150, seek_mode_info, screen);
+/* an entry of the schedule is due, what the background scheduler does
+ * but through the UI, so that it shows */
+static void run_entry(const struct sched_entry *e)
+{
+	switch (e->type) {
+	case SCHED_ALARM:
+		/* taken over in the middle of the fade in, go on from there */
+		if (!e->resumed)
+			ramp_set(0);
+		radio.freq = e->freq;
+		set_frequency(radio.freq);
+		fingerprint_retune();
+		record_tune(radio.freq);
+		radio.station_db = loudness_tune(radio.freq);
+		meter_retune();
+		sched_fade(station_level(), e->seconds, NULL, e);
+		power_activity();
+		break;
+	case SCHED_SLEEP:
+		sleeping = 1;
+		sched_fade(0, e->seconds, sleep_done, e);
+		return;
+	case SCHED_RECORD:
+		radio.freq = e->freq;
+		tune(radio.freq);
+		sched_record(radio.freq, e->seconds);
+		break;
+	}
+
+	dial_set(radio.freq);
+	print_freq(radio.freq, 0);
+	handle_user_freq(FILE_FREQ_WRITE, &radio.freq);
+}
+
+/* event thread: another application changed the mixer */
+static void mixer_changed(int what)
+{
+	SDL_Event event;
+
+	memset(&event, 0, sizeof(event));
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_MIXER;
+	event.user.data1 = (void *)(long)what;
+	SDL_PushEvent(&event);
+}
+
+/* follow the volume keys of the system, or a mixer app: the level they set,
+ * without the correction of this station, becomes the volume of the user,
+ * and the outputs on become the mode */
+static void mixer_moved(int what)
+{
+	struct mixer_state state;
+	long volume;
+	int i;
+
+	mixer_get_state(&state);
+
+	if (what & MIXER_VOLUME) {
+		volume = mixer_volume_offset(state.volume, -radio.station_db);
+		radio.volume = volume > max ? max : volume;
+		ramp_sync(state.volume);
+
+		for (i = 0; i < 32; i++)
+			render_fill(&rects[i], UI_BLACK);
+		draw_volume_bar(radio.volume, STARTUP);
+		handle_sound_level(FILE_VOLUME_WRITE, &radio.volume);
+	}
+
+	if (what & MIXER_ROUTING) {
+		radio.mode = state.speakers ? SPEAKER_TURN_ON : HEADPHONE_TURN_ON;
+		handle_mode(MODE_SET, &radio.mode);
+	}
+
+	render_flush();
+}
+
+/* the screen is back on, draw the text skipped while it was off */
+static void repaint_text(void)
+{
+	show_schedule();
+	print_freq(radio.freq, radio.seeking);
+}
+
+/* The UI is WIDTH x HEIGHT. RADIO_SCALE=n asks for a mode n times bigger,
+ * otherwise a framebuffer console already set bigger (TV out) is kept and
+ * the renderer scales the UI into it.
+ */
+static void video_mode(int *w, int *h)
+{
+	const SDL_VideoInfo *info = SDL_GetVideoInfo();
+	char *env = getenv("RADIO_SCALE");
+	char driver[16];
+
+	*w = WIDTH;
+	*h = HEIGHT;
+
+	if (env) {
+		int n = atoi(env);
+
+		if (n > 1 && n <= RENDER_MAX_SCALE) {
+			*w = WIDTH * n;
+			*h = HEIGHT * n;
+		}
+		return;
+	}
+
+	if (!info || !SDL_VideoDriverName(driver, sizeof(driver)) || strcmp(driver, "fbcon"))
+		return;
+
+	if (info->current_w >= 2 * WIDTH && info->current_h >= 2 * HEIGHT) {
+		*w = info->current_w;
+		*h = info->current_h;
+	}
 }
 
 int main(int argc, char* argv[])
@@ -331,7 +724,8 @@ int main(int argc, char* argv[])
 	SDL_Event event;
   
 	int keypress = 0, lock = 0;
-	long vol, min, max, ret = 0;
+	int width, height;
+	long ret = 0;
 
 	char *button_pressed;
 
@@ -349,22 +743,50 @@ int main(int argc, char* argv[])
 	/* init home path */
 	set_home_path();
 
+	radio.seek_mode = SEEK_AUTO;
+	radio.mode = HEADPHONE_TURN_ON;
+
+	/* the schedule left running when the UI went to background */
+	if (argc > 1 && !strcmp(argv[1], SCHED_ARG))
+		return sched_daemon();
+
+	/* the flight recorder, dumped by kill -USR1 or when things go wrong */
+	char trace_path[255];
+	data_file_path(TRACE_FILE, trace_path, sizeof(trace_path));
+	trace_init(trace_path);
+
+	/* the tuners first, the band is clipped to what they receive */
+	init_controls();
+
+	/* the band of the region, the wide one if there is none */
+	int region = BAND_WIDE;
+	handle_region(MODE_GET, &region);
+	set_band_region(region);
+
+	unsigned int lo, hi;
+	band_range(&lo, &hi);
+
 	/* get last radio station */
-	handle_user_freq(FILE_FREQ_READ, &curr_freq);
+	handle_user_freq(FILE_FREQ_READ, &radio.freq);
 
-	if (curr_freq == 0) {
-		fprintf(stdout, "Using default radio 76.5\n");
-		curr_freq = 76.5;
+	if (radio.freq == 0) {
+		radio.freq = lo / 1000.0f;
+		fprintf(stdout, "Using default radio %.2f\n", radio.freq);
 		/* save as the default radio */
-		handle_user_freq(FILE_FREQ_WRITE, &curr_freq);
+		handle_user_freq(FILE_FREQ_WRITE, &radio.freq);
 
 	} else {
-		if (curr_freq < 76.5 || curr_freq > 108.0) {
-			fprintf(stderr, "%s %f %s", "Frequency ", curr_freq,
-					" out of range(76.5.9 <> 108.0)! Using the freq 76.5.\n");
-			curr_freq = 76.5;
+		unsigned int khz = radio.freq * 1000 + 0.5f;
+
+		if (khz < lo || khz > hi) {
+			fprintf(stderr, "Frequency %.2f out of range(%.2f <> %.2f)! Using the freq %.2f.\n",
+					radio.freq, lo / 1000.0, hi / 1000.0, lo / 1000.0);
+			radio.freq = lo / 1000.0f;
 			/* save as the default radio */
-			handle_user_freq(FILE_FREQ_WRITE, &curr_freq); 
+			handle_user_freq(FILE_FREQ_WRITE, &radio.freq); 
+		} else {
+			/* a channel of the plan */
+			radio.freq = band_snap(khz) / 1000.0f;
 		}
 	}
 
@@ -373,7 +795,9 @@ int main(int argc, char* argv[])
 		return 1;
    	}
 
-	if (!(screen = SDL_SetVideoMode(WIDTH, HEIGHT, DEPTH, SDL_HWSURFACE | SDL_DOUBLEBUF))) {
+	video_mode(&width, &height);
+
+	if (!(screen = SDL_SetVideoMode(width, height, DEPTH, SDL_HWSURFACE | SDL_DOUBLEBUF))) {
 		fprintf(stderr, "Cannot SetVideoMode. Aborting.\n");
 		SDL_Quit();
 		return 1;
@@ -387,152 +811,283 @@ int main(int argc, char* argv[])
 
 	SDL_ShowCursor(SDL_DISABLE);
 
-	init_controls();
+	if (render_init(screen) < 0) {
+		SDL_Quit();
+		return 1;
+	}
+
+	if (events_start() < 0) {
+		fprintf(stderr, "Cannot start the event thread. Aborting.\n");
+		SDL_Quit();
+		return 1;
+	}
+
+	/* seek verification needs the capture, it is off by default */
+	int verify = 0;
+	handle_seek_verify(MODE_GET, &verify);
+	set_seek_verify(verify);
+
+	/* serve the radio over HTTP if the user asked for it */
+	int port = 0;
+	handle_stream_port(MODE_GET, &port);
+	if (port > 0)
+		stream_start(port, &wav_encoder);
 
 	/* get the actual volume, the min and max volume range */
-	mixer_control(VOLUME_GET, &vol, &min, &max);
+	mixer_control(VOLUME_GET, &radio.volume, &min, &max);
+
+	ramp_init(radio.volume);
+
+	/* keep the volume bar and the mode in step with the other applications */
+	mixer_watch(mixer_changed);
 
 	/* verify if the radio is running in background */
 	mixer_control(BYPASS_VERIFICATION, &ret, NULL, NULL);
 
-	int mode = HEADPHONE_TURN_ON;
 	/* we can get HEADPHONE or SPEAKER from handle */
-	handle_mode(MODE_GET, &mode);
+	handle_mode(MODE_GET, &radio.mode);
+
+	/* the optional EQ, bass boost and limiter, the bypass is the default */
+	struct dsp_settings dsp;
+	memset(&dsp, 0, sizeof(dsp));
+	handle_dsp(MODE_GET, &dsp);
+
+	if (dsp.enabled && !dsp_start(&dsp)) {
+		mixer_software_path(1);
+
+		/* take the outputs over from the radio playing in background */
+		if (ret)
+			mixer_control(radio.mode, &radio.volume, &min, &max);
+	}
+
+	/* learn the loudness of the stations and even them out */
+	loudness_start();
+	radio.station_db = loudness_tune(radio.freq);
+
+	/* name the songs when there is a fingerprint index */
+	fingerprint_start();
+
+	/* alarms, sleep timer and recordings */
+	sched_start(schedule_notify);
+
+	/* the mixer has the corrected level, keep the one of the user */
+	if (ret)
+		handle_sound_level(FILE_VOLUME_READ, &radio.volume);
 
 	/* if the radio is running in background, don't set the 
 	 * same things again
          */
 	if (!ret) {
+		/* start silent, and fade in when everything is in place */
+		ramp_set(0);
+
 		/* Initialize the radio by the driver */
-		setup(curr_freq);
+		setup(radio.freq);
 
 		/* Set the flag to turn on the capture line */
-		mixer_control(mode, &vol, &min, &max);
+		mixer_control(radio.mode, &radio.volume, &min, &max);
 
 		/* if we don't have the last_volume file, use the default */
-		handle_sound_level(FILE_VOLUME_READ, &vol);
+		handle_sound_level(FILE_VOLUME_READ, &radio.volume);
 
 		/* set the sound volume */
-		mixer_control(VOLUME_SET, &vol, &min, &max);
+		ramp_to(station_level(), RAMP_IN_MS);
 	}
 
 	setup_volume_bar();
 
 	/* Draw the volume bar at the init */
-	draw_volume_bar(screen, vol, STARTUP);
+	draw_volume_bar(radio.volume, STARTUP);
 
-	handle_fav_radios(FILE_FAVRAD_READ, NULL, 0);
+	handle_fav_radios(FILE_FAVRAD_READ, &radio.favrads, NULL, 0);
 
 	/* Manage the ttf font */
 	load_ttf_font();
+	dial_init(shortcut_font);
+	dial_set(radio.freq);
+	meter_init(shortcut_font);
+	render_set_repaint(repaint_text);
+	power_init();
 	draw_favrads_label();
-	print_freq(curr_freq, 0);
+	show_schedule();
+	print_freq(radio.freq, 0);
 	show_seek_mode();
 	draw_favrads_rects();
+	render_flush();
+	state_publish();
 
 	SDL_EnableKeyRepeat(SDL_DEFAULT_REPEAT_DELAY, SDL_DEFAULT_REPEAT_INTERVAL);
 
 	while(!keypress) {
 		while(SDL_WaitEvent(&event)) {
 			switch (event.type) {
+			case SDL_USEREVENT:
+				/* not the animation frames, they would fill the trace */
+				if (event.user.code != EVENT_FRAME && event.user.code != EVENT_METER)
+					trace_add(TRACE_EVENT, event.user.code, 0, 0, 0);
+
+				if (event.user.code == EVENT_FRAME) {
+					dial_frame();
+				} else if (event.user.code == EVENT_METER) {
+					meter_draw();
+				} else if (event.user.code == EVENT_IDLE) {
+					power_idle();
+				} else if (event.user.code == EVENT_NOW_PLAYING) {
+					if (!radio.seeking)
+						print_freq(radio.freq, 0);
+				} else if (event.user.code == EVENT_SEEK_DONE) {
+					radio.freq = seek_result;
+					seek_done();
+				} else if (event.user.code == EVENT_SCHEDULE) {
+					struct due *d = event.user.data1;
+
+					/* the seek owns the tuner, it waits for seek_done() */
+					if (radio.seeking) {
+						*deferred_tail = d;
+						deferred_tail = &d->next;
+					} else {
+						run_entry(&d->entry);
+						free(d);
+					}
+					show_schedule();
+				} else if (event.user.code == EVENT_SLEEP) {
+					if (sleeping)
+						keypress = 1;
+				} else if (event.user.code == EVENT_MIXER) {
+					mixer_moved((long)event.user.data1);
+				}
+				break;
 			case SDL_QUIT:
 			case SDL_KEYDOWN:
+				trace_add(TRACE_KEY, event.key.keysym.sym, event.type, 0, 0);
 				button_pressed = SDL_GetKeyName(event.key.keysym.sym);
 
 				/* lock the screen */
 				if (!strcmp(button_pressed, "pause")) {
 					lock = 1;
+					power_lock(1);
 					break;
 				}
 
 				/* unlocked screen */
-				if (!strcmp(button_pressed, "unknown key"))
+				if (!strcmp(button_pressed, "unknown key")) {
 					lock = 0;
+					power_lock(0);
+				}
 
 				/* if the screen is locked, do nothing */
 				if (lock)
 					break;
 
+				/* a key on a blank screen only turns it on */
+				if (power_activity())
+					break;
+
+				/* the seek owns the tuner and the volume until it is
+				 * over, only the favorite selection moves */
+				if (radio.seeking && strcmp(button_pressed, "left") &&
+						strcmp(button_pressed, "right"))
+					break;
+
 				if (!strcmp(button_pressed, "down")) {
 					/* avoid negative values */
-					if (vol) {
-						draw_volume_bar(screen, vol == 1 ? 1 : vol, VOLUME_DOWN);
-						vol--;
-						mixer_control(VOLUME_SET, &vol, &min, &max);
-						handle_sound_level(FILE_VOLUME_WRITE, &vol);
+					if (radio.volume) {
+						draw_volume_bar(radio.volume == 1 ? 1 : radio.volume, VOLUME_DOWN);
+						radio.volume--;
+						ramp_to(station_level(), RAMP_STEP_MS);
+						handle_sound_level(FILE_VOLUME_WRITE, &radio.volume);
 					}
 
 				} else if (!strcmp(button_pressed, "up")) {
-					if (vol + 1 <= max) {
-						draw_volume_bar(screen, vol == 0 ? 1 : vol + 1, VOLUME_UP);
-						vol++;
-						mixer_control(VOLUME_SET, &vol, &min, &max);
-						handle_sound_level(FILE_VOLUME_WRITE, &vol);
+					if (radio.volume + 1 <= max) {
+						draw_volume_bar(radio.volume == 0 ? 1 : radio.volume + 1, VOLUME_UP);
+						radio.volume++;
+						ramp_to(station_level(), RAMP_STEP_MS);
+						handle_sound_level(FILE_VOLUME_WRITE, &radio.volume);
 					}
 
 				/* Change to previous fav radio */
 				} else if (!strcmp(button_pressed, "left")) {
-					curr_fav = curr_fav > 0 ? curr_fav - 1 : 0;
+					radio.fav = radio.fav > 0 ? radio.fav - 1 : 0;
 					draw_favrads_rects();
 
 				/* Change to next fav radio */
 				} else if (!strcmp(button_pressed, "right")) {
-					curr_fav = curr_fav >= 4 ? curr_fav : curr_fav + 1;
+					radio.fav = radio.fav >= 4 ? radio.fav : radio.fav + 1;
 					draw_favrads_rects();
 
 				/* the R button -> Seek Next */
 				} else if (!strcmp(button_pressed, "backspace")) {
-					if (seek_mode == SEEK_AUTO) {
-						print_freq(curr_freq, 1);
-						curr_freq = seek_radio_station(SEEK_UP);
+					if (radio.seek_mode == SEEK_AUTO) {
+						start_seek(SEEK_UP);
 					} else {
 						get_next_frequency(SEEK_UP);
-						set_frequency(curr_freq);
+						tune(radio.freq);
+						dial_set(radio.freq);
+						print_freq(radio.freq, 0);
+						handle_user_freq(FILE_FREQ_WRITE, &radio.freq);
 					}
-					print_freq(curr_freq, 0);
-					show_seek_mode();
-					handle_user_freq(FILE_FREQ_WRITE, &curr_freq);
 				
 				/* the L button -> Seek Previous */
 				} else if (!strcmp(button_pressed, "tab")) {
-					if (seek_mode == SEEK_AUTO) {
-						print_freq(curr_freq, 1);
-						curr_freq = seek_radio_station(SEEK_DOWN);
+					if (radio.seek_mode == SEEK_AUTO) {
+						start_seek(SEEK_DOWN);
 					} else {
 						get_next_frequency(SEEK_DOWN);
-						set_frequency(curr_freq);
+						tune(radio.freq);
+						dial_set(radio.freq);
+						print_freq(radio.freq, 0);
+						handle_user_freq(FILE_FREQ_WRITE, &radio.freq);
 					}
-					print_freq(curr_freq, 0);
-					show_seek_mode();
-					handle_user_freq(FILE_FREQ_WRITE, &curr_freq);
 
 				/* Y Button -> Switch between Headphone and Speaker */
 				} else if (!strcmp(button_pressed, "space")) {
-					if (mode == SPEAKER_TURN_ON) {
-						mixer_control(SPEAKER_TURN_OFF, &vol, &min, &max);
-						mixer_control(HEADPHONE_TURN_ON, &vol, &min, &max);
+					ramp_to(0, RAMP_OUT_MS);
+					ramp_wait();
 
-						mode = HEADPHONE_TURN_ON;
-						handle_mode(MODE_SET, &mode);
+					if (radio.mode == SPEAKER_TURN_ON) {
+						mixer_control(SPEAKER_TURN_OFF, &radio.volume, &min, &max);
+						mixer_control(HEADPHONE_TURN_ON, &radio.volume, &min, &max);
+
+						radio.mode = HEADPHONE_TURN_ON;
+						handle_mode(MODE_SET, &radio.mode);
 					} else {
-						mixer_control(HEADPHONE_TURN_OFF, &vol, &min, &max);
-						mixer_control(SPEAKER_TURN_ON, &vol, &min, &max);
+						mixer_control(HEADPHONE_TURN_OFF, &radio.volume, &min, &max);
+						mixer_control(SPEAKER_TURN_ON, &radio.volume, &min, &max);
 
-						mode = SPEAKER_TURN_ON;
-						handle_mode(MODE_SET, &mode);
+						radio.mode = SPEAKER_TURN_ON;
+						handle_mode(MODE_SET, &radio.mode);
 					}
 
+					ramp_to(station_level(), RAMP_IN_MS);
+
 				/* X Button -> Add favorite radio */
 				} else if (!strcmp(button_pressed, "left shift")) {
-					char char_freq[6];
-					sprintf(char_freq, "%.1f", curr_freq);
-					handle_fav_radios(FILE_FAVRAD_WRITE, char_freq, curr_fav);
+					Uint8 *keyState = SDL_GetKeyState(NULL);
+
+					/* Select + X -> scan the band to the favorites */
+					if (keyState[SDLK_ESCAPE]) {
+						print_freq(radio.freq, 1);
+						scan_favorites();
+						print_freq(radio.freq, 0);
+					} else {
+						char char_freq[6];
+						freq_text(char_freq, sizeof(char_freq), radio.freq);
+						handle_fav_radios(FILE_FAVRAD_WRITE, &radio.favrads, char_freq, radio.fav);
+					}
 					draw_favrads_rects();
 
 				/* A Button -> Remove favorite radio */
 				} else if (!strcmp(button_pressed, "left ctrl")) {
-					handle_fav_radios(FILE_FAVRAD_DELETE, "0", curr_fav);
-					draw_favrads_rects();
+					Uint8 *keyState = SDL_GetKeyState(NULL);
+
+					/* Select + A -> sleep timer */
+					if (keyState[SDLK_ESCAPE]) {
+						cycle_sleep_timer();
+					} else {
+						handle_fav_radios(FILE_FAVRAD_DELETE, &radio.favrads, "0", radio.fav);
+						draw_favrads_rects();
+					}
 
 				/* the B button
 				 * Just close the application, and let the radio plays
@@ -544,11 +1099,12 @@ int main(int argc, char* argv[])
 
 				/* Choose favorite radio */
 				} else if (!strcmp(button_pressed, "escape")) {
-					if (strcmp(favrads.radio[curr_fav], "0")) {
-						curr_freq = atof(favrads.radio[curr_fav]);
-						set_frequency(curr_freq);
-						print_freq(curr_freq, 0);
-						handle_user_freq(FILE_FREQ_WRITE, &curr_freq);
+					if (strcmp(radio.favrads.radio[radio.fav], "0")) {
+						radio.freq = atof(radio.favrads.radio[radio.fav]);
+						tune(radio.freq);
+						dial_set(radio.freq);
+						print_freq(radio.freq, 0);
+						handle_user_freq(FILE_FREQ_WRITE, &radio.freq);
 					}
 
 				/* exit when select + start button are pressed */
@@ -559,10 +1115,10 @@ int main(int argc, char* argv[])
 					if (keyState[SDLK_ESCAPE])
 						keypress = 1;
 					else {
-						if (seek_mode == SEEK_AUTO)
-							seek_mode = SEEK_MANUAL;
+						if (radio.seek_mode == SEEK_AUTO)
+							radio.seek_mode = SEEK_MANUAL;
 						else
-							seek_mode = SEEK_AUTO;
+							radio.seek_mode = SEEK_AUTO;
 						show_seek_mode();
 					}
 				} else {
@@ -570,6 +1126,11 @@ int main(int argc, char* argv[])
 					SDL_GetKeyName(event.key.keysym.sym));
 				}
 			}
+			/* one upload for everything this event changed, and one
+			 * copy of the state for the other threads */
+			render_flush();
+			state_publish();
+
 			// break the WaitEvent loop
 			if (keypress)
 				break;
@@ -0,0 +1,61 @@
+/*
+ * state.c - Publish the radio state with a latch: two copies and a
+ *           sequence number. The writer updates one copy while the readers
+ *           are sent to the other, so a reader never waits for the writer,
+ *           it only copies again when the writer moved on meanwhile.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string.h>
+
+#include "state.h"
+
+struct radio_state radio;
+
+static struct radio_state copies[2];
+
+/* even: the readers use copies[0], odd: copies[1] */
+static uint32_t seq;
+
+/* send the readers to the other copy, once they are done with this one */
+static void flip(void)
+{
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void state_publish(void)
+{
+	/* radio and the copies are only written whole, padding included */
+	if (!memcmp(&copies[0], &radio, sizeof(radio)))
+		return;
+
+	flip();
+	copies[0] = radio;
+	flip();
+	copies[1] = radio;
+}
+
+uint32_t state_read(struct radio_state *s)
+{
+	uint32_t start;
+
+	do {
+		start = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+		memcpy(s, &copies[start & 1], sizeof(*s));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&seq, __ATOMIC_RELAXED) != start);
+
+	return start / 2;
+}
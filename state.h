@@ -0,0 +1,44 @@
+/*
+ * state.h - What the radio is doing, owned by the UI thread and published
+ *           for the other threads to read a consistent copy of
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdint.h>
+
+#define MAX_FAVORITES 5
+
+struct radios {
+	char radio[MAX_FAVORITES][6];
+	int num_radios;
+};
+
+struct radio_state {
+	float freq;          /* MHz, the station tuned */
+	float station_db;    /* loudness correction of the station, in dB */
+	long volume;         /* chosen by the user, before the correction */
+	int mode;            /* HEADPHONE_TURN_ON or SPEAKER_TURN_ON */
+	int seek_mode;       /* SEEK_AUTO or SEEK_MANUAL */
+	int seeking;         /* a seek thread is running */
+	int fav;             /* favorite selected */
+	struct radios favrads;
+};
+
+/* The copy of the UI thread. Only that thread changes it, and only it
+ * reads it directly; state_publish() shows the changes to the others.
+ */
+extern struct radio_state radio;
+
+/* copy radio for the readers, if it changed; UI thread only */
+void state_publish(void);
+
+/* A consistent copy of the last state published, from any thread, even a
+ * signal handler. Never waits for the UI. Returns the number of times the
+ * state was published, to tell if it changed since the last look.
+ */
+uint32_t state_read(struct radio_state *s);
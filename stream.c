@@ -0,0 +1,361 @@
+/*
+ * stream.c - HTTP streaming of the radio. The capture tap encodes each
+ *            period once into a shared ring, and every client has only a
+ *            read cursor into it. Pending bytes go straight from the ring
+ *            to the non-blocking sockets with sendmsg, in batches, so a
+ *            new client costs no extra copy or encode.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "events.h"
+#include "state.h"
+#include "stream.h"
+
+#define RING_MASK (STREAM_RING_SIZE - 1)
+
+/* bytes of one captured frame in the ring */
+#define FRAME_BYTES (CAPTURE_CHANNELS * 2)
+
+/* every client is watched by the event thread, next to its other fds */
+#if STREAM_MAX_CLIENTS > EVENTS_MAX_FDS - EVENTS_RESERVED_FDS
+#error "the event thread can't watch every stream client"
+#endif
+
+struct client {
+	int fd;
+	uint64_t cursor;     /* next ring byte to send */
+	char request[512];
+	int request_len;
+	int streaming;       /* request answered, audio is flowing */
+	int dead;            /* send failed, the event thread closes it */
+};
+
+static unsigned char ring[STREAM_RING_SIZE];
+static uint64_t head;    /* bytes ever written to the ring */
+
+static struct client clients[STREAM_MAX_CLIENTS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct stream_encoder *enc;
+static int listen_fd = -1;
+
+static int wav_header(unsigned char *buf, int size)
+{
+	unsigned int rate = CAPTURE_RATE, channels = CAPTURE_CHANNELS;
+	unsigned int byte_rate = rate * channels * 2;
+
+	if (size < 44)
+		return 0;
+
+	/* unknown length, 0xffffffff is what the players expect for a stream */
+	memcpy(buf, "RIFF\xff\xff\xff\xffWAVEfmt ", 16);
+	buf[16] = 16; buf[17] = buf[18] = buf[19] = 0;
+	buf[20] = 1; buf[21] = 0;                       /* PCM */
+	buf[22] = channels; buf[23] = 0;
+	buf[24] = rate; buf[25] = rate >> 8; buf[26] = rate >> 16; buf[27] = rate >> 24;
+	buf[28] = byte_rate; buf[29] = byte_rate >> 8;
+	buf[30] = byte_rate >> 16; buf[31] = byte_rate >> 24;
+	buf[32] = channels * 2; buf[33] = 0;            /* block align */
+	buf[34] = 16; buf[35] = 0;                      /* bits per sample */
+	memcpy(buf + 36, "data\xff\xff\xff\xff", 8);
+
+	return 44;
+}
+
+/* the capture is S16_LE already, like WAV */
+static int wav_encode(const short *frames, unsigned int count, unsigned char *out, int size)
+{
+	int bytes = count * FRAME_BYTES;
+
+	if (bytes > size)
+		bytes = size - size % FRAME_BYTES;
+
+	memcpy(out, frames, bytes);
+	return bytes;
+}
+
+const struct stream_encoder wav_encoder = {
+	.name = "wav",
+	.mime = "audio/wav",
+	.header = wav_header,
+	.encode = wav_encode
+};
+
+static void drop_client(struct client *c)
+{
+	close(c->fd);
+	c->fd = -1;
+}
+
+/* capture thread: the fd is still watched, so only the event thread may
+ * close it. The shutdown wakes it up with a hangup on the socket.
+ */
+static void kill_client(struct client *c)
+{
+	shutdown(c->fd, SHUT_RDWR);
+	c->dead = 1;
+}
+
+/* send what the client has pending, straight from the ring */
+static void flush_client(struct client *c)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+	uint64_t pending = head - c->cursor;
+	unsigned int start, first;
+	ssize_t sent;
+
+	if (c->dead)
+		return;
+
+	/* too slow, the ring went past it: skip to the most recent audio,
+	 * at the same offset in the frame a partial send left the client at
+	 */
+	if (pending > STREAM_RING_SIZE - STREAM_BATCH) {
+		c->cursor = head - STREAM_BATCH - FRAME_BYTES + c->cursor % FRAME_BYTES;
+		pending = head - c->cursor;
+	}
+
+	if (pending < STREAM_BATCH)
+		return;
+
+	start = c->cursor & RING_MASK;
+	first = STREAM_RING_SIZE - start;
+
+	memset(&msg, 0, sizeof(msg));
+	iov[0].iov_base = ring + start;
+	iov[0].iov_len = pending < first ? pending : first;
+	iov[1].iov_base = ring;
+	iov[1].iov_len = pending - iov[0].iov_len;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+
+	sent = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (sent < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			kill_client(c);
+		return;
+	}
+
+	c->cursor += sent;
+}
+
+/* capture thread: encode once, then feed every client */
+static void stream_tap(const short *frames, unsigned int count, void *data)
+{
+	static unsigned char out[CAPTURE_PERIOD * FRAME_BYTES];
+	unsigned int start, first;
+	int i, bytes;
+
+	bytes = enc->encode(frames, count, out, sizeof(out));
+
+	start = head & RING_MASK;
+	first = STREAM_RING_SIZE - start;
+	if (first > bytes)
+		first = bytes;
+
+	memcpy(ring + start, out, first);
+	memcpy(ring, out + first, bytes - first);
+
+	pthread_mutex_lock(&lock);
+	head += bytes;
+
+	for (i = 0; i < STREAM_MAX_CLIENTS; i++)
+		if (clients[i].fd >= 0 && clients[i].streaming)
+			flush_client(&clients[i]);
+	pthread_mutex_unlock(&lock);
+}
+
+/* answer the request with the stream headers, -1 drops the client */
+static int answer_client(struct client *c)
+{
+	struct radio_state state;
+	unsigned char header[256];
+	char response[256];
+	int n, len;
+
+	if (strncmp(c->request, "GET / ", 6) && strncmp(c->request, "GET /radio ", 11)) {
+		len = sprintf(response, "HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n");
+		if (write(c->fd, response, len) < 0)
+			perror("stream: 404");
+		return -1;
+	}
+
+	/* players show the station as the name of the stream */
+	state_read(&state);
+
+	len = sprintf(response, "HTTP/1.0 200 OK\r\nContent-Type: %s\r\n"
+			"icy-name: FM %g MHz\r\n"
+			"Cache-Control: no-cache\r\nConnection: close\r\n\r\n",
+			enc->mime, state.freq);
+	n = enc->header(header, sizeof(header));
+
+	/* small enough for an empty socket buffer */
+	if (write(c->fd, response, len) != len || (n && write(c->fd, header, n) != n))
+		return -1;
+
+	/* live audio from now on */
+	c->cursor = head;
+	c->streaming = 1;
+	printf("Stream: client %d connected\n", c->fd);
+
+	return 0;
+}
+
+/* event thread: read the request, or notice the client went away */
+static void client_readable(int fd, void *data)
+{
+	struct client *c = data;
+	char discard[256];
+	int n, drop = 0;
+
+	pthread_mutex_lock(&lock);
+
+	/* we only send, anything after the request is ignored */
+	if (c->dead) {
+		drop = 1;
+	} else if (c->streaming) {
+		n = read(fd, discard, sizeof(discard));
+		drop = n == 0 || (n < 0 && errno != EAGAIN);
+	} else {
+		n = read(fd, c->request + c->request_len, sizeof(c->request) - 1 - c->request_len);
+
+		if (n <= 0) {
+			drop = n == 0 || errno != EAGAIN;
+		} else {
+			c->request_len += n;
+			c->request[c->request_len] = '\0';
+
+			if (strstr(c->request, "\r\n\r\n") || c->request_len == sizeof(c->request) - 1)
+				drop = answer_client(c) < 0;
+		}
+	}
+
+	if (drop) {
+		events_remove(fd);
+		drop_client(c);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+static void accept_client(int fd, void *data)
+{
+	int i, cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+	if (cfd < 0)
+		return;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < STREAM_MAX_CLIENTS && clients[i].fd >= 0; i++)
+		;
+
+	if (i == STREAM_MAX_CLIENTS) {
+		pthread_mutex_unlock(&lock);
+		close(cfd);
+		return;
+	}
+
+	memset(&clients[i], 0, sizeof(clients[i]));
+	clients[i].fd = cfd;
+	pthread_mutex_unlock(&lock);
+
+	if (events_add(cfd, 0, client_readable, &clients[i]) < 0) {
+		pthread_mutex_lock(&lock);
+		drop_client(&clients[i]);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+int stream_start(int port, const struct stream_encoder *encoder)
+{
+	struct sockaddr_in addr;
+	int i, one = 1;
+
+	for (i = 0; i < STREAM_MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+
+	enc = encoder;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0) {
+		perror("stream: socket");
+		return -1;
+	}
+
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			listen(listen_fd, 4) < 0) {
+		perror("stream: bind");
+		close(listen_fd);
+		listen_fd = -1;
+		return -1;
+	}
+
+	if (capture_start() < 0) {
+		close(listen_fd);
+		listen_fd = -1;
+		return -1;
+	}
+
+	capture_add_tap(stream_tap, NULL);
+	events_add(listen_fd, 0, accept_client, NULL);
+
+	printf("Streaming %s on port %d\n", enc->name, port);
+
+	return 0;
+}
+
+void stream_stop(void)
+{
+	int i;
+
+	if (listen_fd < 0)
+		return;
+
+	capture_remove_tap(stream_tap, NULL);
+	capture_stop();
+
+	/* no new clients after this, and no handler in flight */
+	events_remove(listen_fd);
+	close(listen_fd);
+	listen_fd = -1;
+
+	/* the event lock is taken before ours, never the other way */
+	for (i = 0; i < STREAM_MAX_CLIENTS; i++)
+		if (clients[i].fd >= 0)
+			events_remove(clients[i].fd);
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < STREAM_MAX_CLIENTS; i++)
+		if (clients[i].fd >= 0)
+			drop_client(&clients[i]);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,37 @@
+/*
+ * stream.h - Serve the radio over HTTP to other processes or machines
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define STREAM_MAX_CLIENTS 16
+
+/* shared ring, power of two, ~3 s of 44.1 kHz stereo S16 */
+#define STREAM_RING_SIZE (1 << 19)
+
+/* pending bytes are sent in batches of at least this (~40 ms) */
+#define STREAM_BATCH 7056
+
+/* An encoder turns captured frames into the bytes of the stream. It runs
+ * once per period whatever the number of clients.
+ */
+struct stream_encoder {
+	const char *name;
+	const char *mime;
+
+	/* bytes every client gets before the stream, returns the size */
+	int (*header)(unsigned char *buf, int size);
+
+	/* returns the number of bytes written to out */
+	int (*encode)(const short *frames, unsigned int count, unsigned char *out, int size);
+};
+
+extern const struct stream_encoder wav_encoder;
+
+/* start serving on port, returns 0 on success */
+int stream_start(int port, const struct stream_encoder *encoder);
+void stream_stop(void);
@@ -0,0 +1,198 @@
+/*
+ * fpindex.c - Build the fingerprint index of a music library
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Usage: fpindex <index> <song.wav>...
+ *
+ * The songs are 16 bit PCM WAV files at 44.1 kHz, mono or stereo; decode
+ * compressed files first. The title of each song is its file name without
+ * the extension. Copy the index to ~/.radioplayer/fingerprints.idx.
+ */
+
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../fphash.h"
+
+#define READ_FRAMES 4096
+
+/* songs longer than this are only indexed up to it, ~50 min */
+#define MAX_FRAMES 65535
+
+static struct fp_entry *entries;
+static size_t num_entries, max_entries;
+static unsigned int track;
+
+static void add_entry(uint32_t hash, uint32_t time, void *data)
+{
+	if (time > MAX_FRAMES)
+		return;
+
+	if (num_entries == max_entries) {
+		max_entries = max_entries ? max_entries * 2 : 65536;
+		entries = realloc(entries, max_entries * sizeof(*entries));
+		if (!entries) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+
+	entries[num_entries].hash = hash;
+	entries[num_entries].track = track;
+	entries[num_entries].time = time;
+	num_entries++;
+}
+
+static uint32_t read_u32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* hash the data chunk of a WAV file, returns 0 on success */
+static int hash_wav(const char *name)
+{
+	static short frames[READ_FRAMES * 2], mono[READ_FRAMES];
+	unsigned char chunk[8], fmt[16];
+	struct fp_hasher hasher;
+	int channels = 0, ok = 0;
+	FILE *file = fopen(name, "rb");
+	size_t n, i;
+
+	if (!file) {
+		perror(name);
+		return -1;
+	}
+
+	if (fread(chunk, 1, 8, file) != 8 || memcmp(chunk, "RIFF", 4) ||
+			fread(chunk, 1, 4, file) != 4 || memcmp(chunk, "WAVE", 4)) {
+		fprintf(stderr, "%s: not a WAV file\n", name);
+		fclose(file);
+		return -1;
+	}
+
+	while (fread(chunk, 1, 8, file) == 8) {
+		uint32_t size = read_u32(chunk + 4);
+
+		if (!memcmp(chunk, "fmt ", 4) && size >= 16 && fread(fmt, 1, 16, file) == 16) {
+			channels = fmt[2] | fmt[3] << 8;
+			ok = (fmt[0] | fmt[1] << 8) == 1 && read_u32(fmt + 4) == FP_INPUT_RATE &&
+				(fmt[14] | fmt[15] << 8) == 16 && (channels == 1 || channels == 2);
+			fseek(file, size - 16 + (size & 1), SEEK_CUR);
+		} else if (!memcmp(chunk, "data", 4)) {
+			break;
+		} else {
+			fseek(file, size + (size & 1), SEEK_CUR);
+		}
+	}
+
+	if (!ok) {
+		fprintf(stderr, "%s: only 16 bit PCM at %d Hz is supported\n", name, FP_INPUT_RATE);
+		fclose(file);
+		return -1;
+	}
+
+	fp_init(&hasher);
+
+	while ((n = fread(frames, 2 * channels, READ_FRAMES, file)) > 0) {
+		for (i = 0; i < n; i++)
+			mono[i] = channels == 1 ? frames[i] : (frames[2 * i] + frames[2 * i + 1]) / 2;
+		fp_feed(&hasher, mono, n, add_entry, NULL);
+	}
+
+	fclose(file);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static char titles[65535][FP_TITLE_LEN];
+	struct fp_index_header header;
+	struct fp_entry *sorted;
+	uint32_t *starts, buckets, b;
+	size_t i, first;
+	FILE *out;
+	int arg;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <index> <song.wav>...\n", argv[0]);
+		return 1;
+	}
+
+	for (arg = 2; arg < argc && track < 65535; arg++) {
+		char *title, *dot;
+
+		first = num_entries;
+		if (hash_wav(argv[arg]) < 0)
+			continue;
+
+		title = basename(argv[arg]);
+		dot = strrchr(title, '.');
+		if (dot)
+			*dot = '\0';
+		snprintf(titles[track], FP_TITLE_LEN, "%s", title);
+
+		printf("%5u %s: %zu hashes\n", track, titles[track], num_entries - first);
+		track++;
+	}
+
+	if (!num_entries) {
+		fprintf(stderr, "Nothing to index\n");
+		return 1;
+	}
+
+	/* about 8 entries per bucket */
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FP_INDEX_MAGIC, 8);
+	header.log2_buckets = 1;
+	while ((num_entries >> header.log2_buckets) > 8 && header.log2_buckets < 28)
+		header.log2_buckets++;
+	header.num_entries = num_entries;
+	header.num_tracks = track;
+	buckets = 1u << header.log2_buckets;
+
+	/* counting sort by bucket */
+	starts = calloc(buckets + 1, sizeof(*starts));
+	sorted = malloc(num_entries * sizeof(*sorted));
+	if (!starts || !sorted) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < num_entries; i++)
+		starts[fp_bucket(entries[i].hash, header.log2_buckets) + 1]++;
+	for (b = 0; b < buckets; b++)
+		starts[b + 1] += starts[b];
+	for (i = 0; i < num_entries; i++)
+		sorted[starts[fp_bucket(entries[i].hash, header.log2_buckets)]++] = entries[i];
+
+	/* the placement moved every start to the next bucket */
+	for (b = buckets; b > 0; b--)
+		starts[b] = starts[b - 1];
+	starts[0] = 0;
+
+	out = fopen(argv[1], "wb");
+	if (!out) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+			fwrite(starts, sizeof(*starts), buckets + 1, out) != buckets + 1 ||
+			fwrite(sorted, sizeof(*sorted), num_entries, out) != num_entries ||
+			fwrite(titles, FP_TITLE_LEN, track, out) != track) {
+		perror(argv[1]);
+		fclose(out);
+		return 1;
+	}
+
+	fclose(out);
+	printf("%u songs, %zu hashes, %u buckets\n", track, num_entries, buckets);
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * recclip.c - Look into a recording, cut a part of it, or turn it to WAV
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Usage: recclip <recording>
+ *        recclip <recording> <from> <to> <out.rrec | out.wav>
+ *
+ * Times are seconds from the start of the recording, or m:ss or h:mm:ss.
+ * The first form prints the length of the recording and where the station
+ * changed. The second copies whole blocks to a new recording, or writes
+ * the audio between from and to as a WAV file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../recfile.h"
+
+static uint64_t parse_ms(const char *text)
+{
+	unsigned int h = 0, m = 0, s = 0;
+
+	if (sscanf(text, "%u:%u:%u", &h, &m, &s) == 3)
+		return (h * 3600ULL + m * 60 + s) * 1000;
+	if (sscanf(text, "%u:%u", &m, &s) == 2)
+		return (m * 60ULL + s) * 1000;
+
+	return atof(text) * 1000;
+}
+
+static void print_time(uint64_t ms)
+{
+	unsigned long s = ms / 1000;
+
+	printf("%lu:%02lu:%02lu", s / 3600, s / 60 % 60, s % 60);
+}
+
+static void info(const struct rec_reader *r)
+{
+	size_t i;
+
+	printf("%u Hz, %u channels, %zu blocks, ", r->header.rate, r->header.channels, r->count);
+	print_time(r->count ? r->index[r->count - 1].time_ms - r->header.start_ms : 0);
+	printf("\n");
+
+	for (i = 0; i < r->count; i++) {
+		if (!(r->index[i].flags & REC_MARK_TUNE))
+			continue;
+
+		print_time(r->index[i].time_ms - r->header.start_ms);
+		printf("  %.1f MHz\n", r->index[i].khz / 1000.0);
+	}
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static int write_wav(const struct rec_reader *r, uint64_t from_ms, uint64_t to_ms,
+		const char *name)
+{
+	unsigned int frame_bytes = r->header.channels * 2;
+	unsigned char header[44];
+	struct rec_block block;
+	uint32_t bytes = 0;
+	short *frames;
+	size_t pos;
+	FILE *out;
+	int n;
+
+	frames = malloc((size_t)r->header.block_frames * frame_bytes);
+	out = fopen(name, "wb");
+	if (!frames || !out) {
+		perror(name);
+		free(frames);
+		return 1;
+	}
+
+	/* the sizes are written at the end */
+	memset(header, 0, sizeof(header));
+	fwrite(header, sizeof(header), 1, out);
+
+	for (pos = rec_find(r, from_ms); pos < r->count; pos++) {
+		uint64_t t = r->index[pos].time_ms - r->header.start_ms;
+		uint32_t skip = 0, take;
+
+		if (t >= to_ms)
+			break;
+
+		n = rec_read(r, pos, &block, frames, r->header.block_frames);
+		if (n < 0)
+			break;
+
+		/* keep to the frames between from and to */
+		if (t < from_ms)
+			skip = (from_ms - t) * r->header.rate / 1000;
+		take = (to_ms - t) * r->header.rate / 1000;
+		if (take > (uint32_t)n)
+			take = n;
+		if (skip >= take)
+			continue;
+
+		fwrite(frames + skip * r->header.channels, frame_bytes, take - skip, out);
+		bytes += (take - skip) * frame_bytes;
+	}
+
+	memcpy(header, "RIFF", 4);
+	put_le32(header + 4, bytes + 36);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_le32(header + 16, 16);
+	header[20] = 1;                                 /* PCM */
+	header[22] = r->header.channels;
+	put_le32(header + 24, r->header.rate);
+	put_le32(header + 28, r->header.rate * frame_bytes);
+	header[32] = frame_bytes;                       /* block align */
+	header[34] = 16;                                /* bits per sample */
+	memcpy(header + 36, "data", 4);
+	put_le32(header + 40, bytes);
+
+	fseek(out, 0, SEEK_SET);
+	fwrite(header, sizeof(header), 1, out);
+	fclose(out);
+	free(frames);
+
+	printf("%s: %u s\n", name, bytes / (r->header.rate * frame_bytes));
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct rec_reader r;
+	uint64_t from, to;
+	const char *dot;
+	int ret = 0;
+
+	if (argc != 2 && argc != 5) {
+		fprintf(stderr, "Usage: %s <recording> [<from> <to> <out.rrec|out.wav>]\n", argv[0]);
+		return 1;
+	}
+
+	if (rec_open(&r, argv[1]) < 0)
+		return 1;
+
+	if (argc == 2) {
+		info(&r);
+		rec_close(&r);
+		return 0;
+	}
+
+	from = parse_ms(argv[2]);
+	to = parse_ms(argv[3]);
+	dot = strrchr(argv[4], '.');
+
+	if (dot && !strcmp(dot, ".wav"))
+		ret = write_wav(&r, from, to, argv[4]);
+	else if (rec_clip(&r, from, to, argv[4]) < 0)
+		ret = 1;
+
+	rec_close(&r);
+	return ret;
+}
@@ -0,0 +1,190 @@
+/*
+ * tracedump.c - Print the timeline kept by the flight recorder
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Usage: tracedump [~/.radioplayer/trace]
+ *
+ * The radio dumps its trace when the tuner fails, when it crashes, or with
+ * kill -USR1 <pid>. Each line is the time before the dump, the wall clock
+ * time, and the record; ioctls and mixer calls show how long they took.
+ */
+
+#include <linux/videodev2.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../trace.h"
+
+/* in the order of the enums of radio.h and trace.h */
+static const char *const events[] = {
+	"frame", "seek done", "meter", "idle", "now playing", "schedule",
+	"sleep", "mixer"
+};
+
+static const char *const mixer_modes[] = {
+	"volume get", "volume set", "bypass verification", "headphone on",
+	"headphone off", "speaker on", "speaker off"
+};
+
+static const char *const settings[] = {
+	"last_freq", "last_volume", "last_mode", "seek_verify", "stream_port",
+	"dsp", "loudness", "schedule", "favorite_radios", "region"
+};
+
+static const char *const reasons[] = { "on request", "fatal error", "crash" };
+
+#define NAME(table, i) ((unsigned int)(i) < sizeof(table) / sizeof(table[0]) ? \
+		table[i] : "?")
+
+static const char *ioctl_name(unsigned int nr)
+{
+	if (nr == _IOC_NR(VIDIOC_QUERYCAP))
+		return "QUERYCAP";
+	if (nr == _IOC_NR(VIDIOC_G_TUNER))
+		return "G_TUNER";
+	if (nr == _IOC_NR(VIDIOC_S_TUNER))
+		return "S_TUNER";
+	if (nr == _IOC_NR(VIDIOC_G_FREQUENCY))
+		return "G_FREQUENCY";
+	if (nr == _IOC_NR(VIDIOC_S_FREQUENCY))
+		return "S_FREQUENCY";
+	if (nr == _IOC_NR(VIDIOC_G_CTRL))
+		return "G_CTRL";
+	if (nr == _IOC_NR(VIDIOC_S_CTRL))
+		return "S_CTRL";
+	if (nr == _IOC_NR(VIDIOC_S_HW_FREQ_SEEK))
+		return "S_HW_FREQ_SEEK";
+
+	return "?";
+}
+
+static int by_seq(const void *a, const void *b)
+{
+	const struct trace_record *x = a, *y = b;
+
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void print_result(const struct trace_record *r)
+{
+	if (r->result < 0)
+		printf(" failed: %s", strerror(-r->result));
+	if (r->duration_us)
+		printf(" (%u us)", r->duration_us);
+}
+
+static void print_record(const struct trace_header *h, const struct trace_record *r)
+{
+	uint64_t real_ns = h->real_ns - (h->mono_ns - r->ns);
+	time_t sec = real_ns / 1000000000ULL;
+	char clock[16];
+
+	strftime(clock, sizeof(clock), "%H:%M:%S", localtime(&sec));
+	printf("%12.6f  %s.%03u  ", -(double)(h->mono_ns - r->ns) / 1e9, clock,
+			(unsigned int)(real_ns / 1000000 % 1000));
+
+	switch (r->type) {
+	case TRACE_START:
+		printf("start, pid %d", r->arg);
+		break;
+	case TRACE_KEY:
+		printf("key %u (SDL event %d)", r->code, r->arg);
+		break;
+	case TRACE_EVENT:
+		printf("event %s", NAME(events, r->code));
+		break;
+	case TRACE_IOCTL:
+		printf("ioctl %s %d -> %d", ioctl_name(r->code), r->arg, r->result);
+		print_result(r);
+		break;
+	case TRACE_MIXER:
+		printf("mixer %s %d", NAME(mixer_modes, r->code), r->arg);
+		print_result(r);
+		break;
+	case TRACE_MIXER_LEVEL:
+		printf("mixer level %d", r->arg);
+		print_result(r);
+		break;
+	case TRACE_MIXER_CHANGE:
+		printf("mixer changed by another application:%s%s, volume %d",
+				r->code & 1 ? " volume" : "", r->code & 2 ? " routing" : "",
+				r->arg);
+		break;
+	case TRACE_SETTING:
+		printf("write %s %d", NAME(settings, r->code), r->arg);
+		print_result(r);
+		break;
+	case TRACE_FATAL:
+		printf("fatal: %s", NAME(reasons, r->code));
+		if (r->arg)
+			printf(", signal %d", r->arg);
+		break;
+	default:
+		printf("record of type %u", r->type);
+	}
+
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct trace_header header;
+	struct trace_record *records;
+	char path[255];
+	size_t i, n = 0;
+	time_t sec;
+	FILE *f;
+
+	if (argc > 1)
+		snprintf(path, sizeof(path), "%s", argv[1]);
+	else
+		snprintf(path, sizeof(path), "%s/.radioplayer/%s", getenv("HOME"), TRACE_FILE);
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+			memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic))) {
+		fprintf(stderr, "%s: not a trace\n", path);
+		fclose(f);
+		return 1;
+	}
+
+	records = calloc(header.records, sizeof(*records));
+	if (!records) {
+		fclose(f);
+		return 1;
+	}
+
+	/* keep the records written completely, in the slot of their number */
+	for (i = 0; i < header.records; i++) {
+		if (fread(&records[n], sizeof(*records), 1, f) != 1)
+			break;
+		if (records[n].seq && (records[n].seq & (header.records - 1)) == i)
+			n++;
+	}
+	fclose(f);
+
+	qsort(records, n, sizeof(*records), by_seq);
+
+	sec = header.real_ns / 1000000000ULL;
+	printf("pid %u, dumped %s (%s), %zu records, %u older ones overwritten\n",
+			header.pid, NAME(reasons, header.reason), strtok(ctime(&sec), "\n"), n,
+			header.next_seq - 1 > n ? (unsigned int)(header.next_seq - 1 - n) : 0);
+
+	for (i = 0; i < n; i++)
+		print_record(&header, &records[i]);
+
+	free(records);
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * trace.c - Flight recorder. Writers take a sequence number with one
+ *           atomic add and fill the record it points to, so that tracing
+ *           costs a clock read and a few stores. The dump only does
+ *           open and write, it runs from signal handlers.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TRACE_MASK (TRACE_RING_SIZE - 1)
+
+static struct trace_record ring[TRACE_RING_SIZE];
+
+/* 32 bits, the MIPS32 target has no 64 bit atomics */
+static uint32_t next_seq;
+
+static char dump_path[255];
+
+uint64_t trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void trace_add(int type, int code, long arg, int result, uint64_t start)
+{
+	uint32_t seq = __atomic_add_fetch(&next_seq, 1, __ATOMIC_RELAXED);
+	struct trace_record *r = &ring[seq & TRACE_MASK];
+	uint64_t now = trace_now();
+
+	/* a dump in the middle sees 0, and skips the record */
+	__atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	r->ns = now;
+	r->type = type;
+	r->code = code;
+	r->arg = arg;
+	r->result = result;
+	r->duration_us = start ? (now - start) / 1000 : 0;
+
+	__atomic_store_n(&r->seq, seq, __ATOMIC_RELEASE);
+}
+
+void trace_dump(int reason)
+{
+	struct trace_header header;
+	struct timespec ts;
+	int fd;
+
+	if (!dump_path[0])
+		return;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.records = TRACE_RING_SIZE;
+	header.reason = reason;
+	header.pid = getpid();
+	header.next_seq = __atomic_load_n(&next_seq, __ATOMIC_ACQUIRE) + 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	header.mono_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	header.real_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+
+	/* the decoder puts the records in order and drops the torn ones */
+	if (write(fd, &header, sizeof(header)) == sizeof(header) &&
+			write(fd, ring, sizeof(ring)) == sizeof(ring))
+		fsync(fd);
+	close(fd);
+}
+
+static void trace_signal(int sig)
+{
+	int saved = errno;
+
+	if (sig == SIGUSR1) {
+		trace_dump(TRACE_DUMP_REQUEST);
+		errno = saved;
+		return;
+	}
+
+	trace_add(TRACE_FATAL, TRACE_DUMP_CRASH, sig, 0, 0);
+	trace_dump(TRACE_DUMP_CRASH);
+
+	/* die from the signal, as without the handler */
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+int trace_init(const char *path)
+{
+	struct sigaction act;
+
+	snprintf(dump_path, sizeof(dump_path), "%s", path);
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = trace_signal;
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = SA_RESTART;
+
+	if (sigaction(SIGUSR1, &act, NULL) < 0 ||
+			sigaction(SIGABRT, &act, NULL) < 0 ||
+			sigaction(SIGSEGV, &act, NULL) < 0) {
+		perror("trace");
+		return -1;
+	}
+
+	trace_add(TRACE_START, 0, getpid(), 0, 0);
+	return 0;
+}
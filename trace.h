@@ -0,0 +1,89 @@
+/*
+ * trace.h - Flight recorder: the last key presses, tuner ioctls, mixer
+ *           calls and settings writes, kept in a ring in memory and
+ *           dumped to ~/.radioplayer when something goes wrong
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "RADIOTRC"
+
+/* records in the ring, a power of two */
+#define TRACE_RING_SIZE 4096
+
+/* the dump is ~/.radioplayer/TRACE_FILE, see tools/tracedump.c */
+#define TRACE_FILE "trace"
+
+enum trace_types {
+	TRACE_START,          /* the UI started, arg is the pid */
+	TRACE_KEY,            /* code is the SDL key, arg the SDL event type */
+	TRACE_EVENT,          /* code is the user_events code */
+	TRACE_IOCTL,          /* code is _IOC_NR, see tuner_ioctl() */
+	TRACE_MIXER,          /* code is the mixer_modes mode, arg the volume */
+	TRACE_MIXER_LEVEL,    /* arg is the level the ramp set */
+	TRACE_MIXER_CHANGE,   /* code is what another application changed */
+	TRACE_SETTING,        /* code is the trace_settings file, arg its value */
+	TRACE_FATAL           /* code is the trace_dumps reason */
+};
+
+/* the settings files written, for TRACE_SETTING */
+enum trace_settings {
+	TRACE_SET_FREQ,
+	TRACE_SET_VOLUME,
+	TRACE_SET_MODE,
+	TRACE_SET_SEEK_VERIFY,
+	TRACE_SET_STREAM_PORT,
+	TRACE_SET_DSP,
+	TRACE_SET_LOUDNESS,
+	TRACE_SET_SCHEDULE,
+	TRACE_SET_FAVRADS,
+	TRACE_SET_REGION
+};
+
+/* why the ring was dumped */
+enum trace_dumps {
+	TRACE_DUMP_REQUEST,   /* SIGUSR1 */
+	TRACE_DUMP_FATAL,     /* the radio can't go on, see radio_settings.c */
+	TRACE_DUMP_CRASH      /* SIGABRT or SIGSEGV */
+};
+
+struct trace_record {
+	uint64_t ns;          /* CLOCK_MONOTONIC */
+	uint32_t seq;         /* from 1, 0 while the record is written */
+	uint16_t type;
+	uint16_t code;
+	int32_t arg;
+	int32_t result;       /* -errno on failure */
+	uint32_t duration_us;
+	uint32_t reserved;
+};
+
+/* the dump is this header and the whole ring, as it was */
+struct trace_header {
+	char magic[8];
+	uint32_t records;
+	uint32_t reason;
+	uint32_t pid;
+	uint32_t next_seq;
+	uint64_t mono_ns;     /* both clocks at the dump, to date the records */
+	uint64_t real_ns;
+};
+
+/* dump to path on SIGUSR1, SIGABRT and SIGSEGV from now on, 0 on success */
+int trace_init(const char *path);
+
+uint64_t trace_now(void);
+
+/* Add a record, from any thread and without locks. start is the
+ * trace_now() of the start of the call for the duration, or 0.
+ */
+void trace_add(int type, int code, long arg, int result, uint64_t start);
+
+/* write the ring to the path of trace_init(), async signal safe */
+void trace_dump(int reason);
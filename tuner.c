@@ -0,0 +1,566 @@
+/*
+ * tuner.c - Low level tuner access and the software seek engine, used
+ *           when the driver can't do VIDIOC_S_HW_FREQ_SEEK
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "tuner.h"
+#include "tuner_sim.h"
+
+/* everything derived from a plan is worked out by the compiler */
+#define PLAN(name, lo, hi, step, us) { name, lo, hi, step, \
+	(SW_SEEK_COARSE_KHZ + (step) - 1) / (step) * (step), ((hi) - (lo)) / (step) + 1, us }
+
+static const struct band_plan band_plans[BAND_REGIONS] = {
+	[BAND_WIDE]     = PLAN("wide",      76500, 108000, 100,  0),
+	[BAND_EUROPE]   = PLAN("europe",    87500, 108000, 100, 50),
+	[BAND_AMERICAS] = PLAN("americas",  87900, 107900, 200, 75),
+	[BAND_JAPAN]    = PLAN("japan",     76000,  95000, 100, 50),
+	[BAND_OIRT]     = PLAN("oirt",      65900,  74000,  30, 50)
+};
+
+static const struct band_plan *active = &band_plans[BAND_WIDE];
+
+static long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* the value of arg worth keeping in the trace */
+static long trace_arg(unsigned long request, void *arg)
+{
+	switch (request) {
+	case VIDIOC_S_FREQUENCY:
+	case VIDIOC_G_FREQUENCY:
+		return ((struct v4l2_frequency *)arg)->frequency;
+	case VIDIOC_G_TUNER:
+		return ((struct v4l2_tuner *)arg)->signal;
+	case VIDIOC_S_CTRL:
+	case VIDIOC_G_CTRL:
+		return ((struct v4l2_control *)arg)->value;
+	case VIDIOC_S_HW_FREQ_SEEK:
+		return ((struct v4l2_hw_freq_seek *)arg)->seek_upward;
+	}
+
+	return 0;
+}
+
+int tuner_ioctl(int fd, unsigned long request, void *arg)
+{
+	uint64_t start = trace_now();
+	int ret, err;
+
+	if (tuner_sim_is_fd(fd))
+		ret = tuner_sim_ioctl(fd, request, arg);
+	else
+		ret = ioctl(fd, request, arg);
+
+	err = errno;
+	trace_add(TRACE_IOCTL, _IOC_NR(request), trace_arg(request, arg),
+			ret < 0 ? -err : ret, start);
+	errno = err;
+
+	return ret;
+}
+
+/* With V4L2_TUNER_CAP_LOW the unit is 62.5 Hz, otherwise it is 62.5 kHz */
+unsigned int tuner_khz_to_units(const struct v4l2_tuner *tuner, unsigned int khz)
+{
+	if (tuner->capability & V4L2_TUNER_CAP_LOW)
+		return khz * 16;
+
+	return khz * 2 / 125;
+}
+
+unsigned int tuner_units_to_khz(const struct v4l2_tuner *tuner, unsigned int units)
+{
+	if (tuner->capability & V4L2_TUNER_CAP_LOW)
+		return (units + 8) / 16;
+
+	return units * 125 / 2;
+}
+
+int tuner_has_hw_seek(int fd, const struct v4l2_tuner *tuner)
+{
+	struct v4l2_capability cap;
+
+	if (tuner->capability & (V4L2_TUNER_CAP_HWSEEK_BOUNDED | V4L2_TUNER_CAP_HWSEEK_WRAP))
+		return 1;
+
+	memset(&cap, 0, sizeof(cap));
+	if (tuner_ioctl(fd, VIDIOC_QUERYCAP, &cap) < 0)
+		return 0;
+
+	return (cap.capabilities & V4L2_CAP_HW_FREQ_SEEK) != 0;
+}
+
+int tuner_dev_init(struct tuner_dev *dev, int fd, const char *path)
+{
+	memset(dev, 0, sizeof(*dev));
+	dev->fd = fd;
+	dev->settle_us = SW_SETTLE_INIT_US;
+	snprintf(dev->path, sizeof(dev->path), "%s", path);
+
+	/* the tuner tells the frequency unit and if it can seek by itself */
+	if (tuner_ioctl(fd, VIDIOC_G_TUNER, &dev->tuner) < 0) {
+		perror(path);
+		return -1;
+	}
+
+	dev->hw_seek = tuner_has_hw_seek(fd, &dev->tuner);
+
+	return 0;
+}
+
+void tuner_dev_close(struct tuner_dev *dev)
+{
+	if (tuner_sim_is_fd(dev->fd))
+		tuner_sim_close(dev->fd);
+	else
+		close(dev->fd);
+
+	dev->fd = -1;
+}
+
+static int cmp_path(const void *a, const void *b)
+{
+	const struct tuner_dev *da = a, *db = b;
+	int la = strlen(da->path), lb = strlen(db->path);
+
+	/* radio2 comes before radio10 */
+	return la != lb ? la - lb : strcmp(da->path, db->path);
+}
+
+int tuner_enumerate(struct tuner_dev *devs, int max)
+{
+	char *sim = getenv("RADIO_SIM");
+	struct dirent *entry;
+	DIR *dir;
+	int count = 0;
+
+	if (sim) {
+		int i, wanted = atoi(sim) > 0 ? atoi(sim) : 1;
+
+		for (i = 0; i < wanted && count < max; i++) {
+			char name[32];
+			int fd = tuner_sim_open(TUNER_SIM_LOCK_US);
+
+			sprintf(name, "sim%d", i);
+			if (fd >= 0 && tuner_dev_init(&devs[count], fd, name) == 0)
+				count++;
+		}
+		return count;
+	}
+
+	dir = opendir("/dev");
+	if (!dir)
+		return 0;
+
+	while ((entry = readdir(dir)) && count < max) {
+		char path[32];
+		int fd;
+
+		if (strncmp(entry->d_name, "radio", 5) || !entry->d_name[5])
+			continue;
+
+		snprintf(path, sizeof(path), "/dev/%.20s", entry->d_name);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		if (tuner_dev_init(&devs[count], fd, path) == 0)
+			count++;
+		else
+			close(fd);
+	}
+	closedir(dir);
+
+	qsort(devs, count, sizeof(devs[0]), cmp_path);
+
+	return count;
+}
+
+static int tune(struct tuner_dev *dev, unsigned int khz)
+{
+	struct v4l2_frequency freq;
+
+	memset(&freq, 0, sizeof(freq));
+	freq.tuner = 0;
+	freq.type = V4L2_TUNER_RADIO;
+	freq.frequency = tuner_khz_to_units(&dev->tuner, khz);
+
+	/* read by the UI to follow a seek */
+	dev->probe_khz = khz;
+
+	return tuner_ioctl(dev->fd, VIDIOC_S_FREQUENCY, &freq);
+}
+
+static int read_signal(struct tuner_dev *dev)
+{
+	struct v4l2_tuner tuner;
+
+	memset(&tuner, 0, sizeof(tuner));
+	if (tuner_ioctl(dev->fd, VIDIOC_G_TUNER, &tuner) < 0)
+		return -1;
+
+	return tuner.signal;
+}
+
+/* coarse probe: one sample after the current settle time */
+static int probe(struct tuner_dev *dev, unsigned int khz)
+{
+	if (tune(dev, khz) < 0)
+		return -1;
+
+	usleep(dev->settle_us);
+	return read_signal(dev);
+}
+
+/* fine probe: sample until two reads agree and learn the lock time from it */
+static int probe_locked(struct tuner_dev *dev, unsigned int khz)
+{
+	long start, lock;
+	int prev, sig;
+
+	if (tune(dev, khz) < 0)
+		return -1;
+
+	start = now_us();
+	usleep(SW_SETTLE_MIN_US);
+	prev = read_signal(dev);
+
+	for (;;) {
+		usleep(SW_SETTLE_MIN_US);
+		sig = read_signal(dev);
+		lock = now_us() - start;
+
+		if (sig < 0 || abs(sig - prev) < 1024 || lock >= SW_SETTLE_MAX_US)
+			break;
+		prev = sig;
+	}
+
+	/* keep a 25% margin over what the tuner needed this time */
+	dev->settle_us = (7 * dev->settle_us + lock + lock / 4) / 8;
+
+	if (dev->settle_us < SW_SETTLE_MIN_US)
+		dev->settle_us = SW_SETTLE_MIN_US;
+	else if (dev->settle_us > SW_SETTLE_MAX_US)
+		dev->settle_us = SW_SETTLE_MAX_US;
+
+	return sig;
+}
+
+/* Look for the peak on the fine raster around a coarse hit. Every channel
+ * is within half a coarse step of a coarse probe, the climb goes up to a
+ * whole one on each side for a peak right on the edge of the next cell,
+ * and stops on a side as soon as the signal drops.
+ */
+static int find_peak(struct tuner_dev *dev, unsigned int f, unsigned int lo,
+		unsigned int hi, unsigned int step, unsigned int reach,
+		unsigned int skip, unsigned int *peak, int *refines)
+{
+	int dir, k, sig, prev, center = -1, best = -1;
+
+	if (f != skip) {
+		(*refines)++;
+		center = best = probe_locked(dev, f);
+		*peak = f;
+	}
+
+	for (dir = -1; dir <= 1; dir += 2) {
+		prev = center;
+
+		for (k = 1; k * step <= reach; k++) {
+			unsigned int cf = f + dir * k * step;
+
+			if (cf < lo || cf > hi)
+				break;
+			if (cf == skip)
+				continue;
+
+			(*refines)++;
+			sig = probe_locked(dev, cf);
+			if (sig > best) {
+				best = sig;
+				*peak = cf;
+			}
+
+			/* past the top on this side */
+			if (sig <= prev)
+				break;
+			prev = sig;
+		}
+	}
+
+	return best;
+}
+
+const struct band_plan *band_plan(int region)
+{
+	if (region < 0 || region >= BAND_REGIONS)
+		region = BAND_WIDE;
+
+	return &band_plans[region];
+}
+
+int band_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < BAND_REGIONS; i++)
+		if (!strcmp(name, band_plans[i].name))
+			return i;
+
+	return -1;
+}
+
+const struct band_plan *band_active(void)
+{
+	return active;
+}
+
+void band_select(int region)
+{
+	active = band_plan(region);
+}
+
+unsigned int band_snap(unsigned int khz)
+{
+	const struct band_plan *plan = active;
+
+	if (khz <= plan->min_khz)
+		return plan->min_khz;
+	if (khz >= plan->max_khz)
+		return plan->max_khz;
+
+	return plan->min_khz + (khz - plan->min_khz + plan->step_khz / 2) /
+		plan->step_khz * plan->step_khz;
+}
+
+int tuner_band_range(const struct v4l2_tuner *tuner, const struct band_plan *plan,
+		unsigned int *lo, unsigned int *hi)
+{
+	unsigned int step = plan->step_khz;
+
+	*lo = plan->min_khz;
+	*hi = plan->max_khz;
+
+	/* clipped to the tuner, on the first and last channels inside it */
+	if (tuner->rangehigh > tuner->rangelow) {
+		unsigned int rlo = tuner_units_to_khz(tuner, tuner->rangelow);
+		unsigned int rhi = tuner_units_to_khz(tuner, tuner->rangehigh);
+
+		if (rhi < *lo || rlo > *hi)
+			return -1;
+
+		if (rlo > *lo)
+			*lo += (rlo - *lo + step - 1) / step * step;
+		if (rhi < *hi)
+			*hi = plan->min_khz + (rhi - plan->min_khz) / step * step;
+	}
+
+	return *lo <= *hi ? 0 : -1;
+}
+
+int sw_seek(struct tuner_dev *dev, unsigned int *freq, int upward,
+		struct sw_seek_stats *stats)
+{
+	const struct band_plan *plan = active;
+	unsigned int lo, hi, f, coarse = plan->coarse_khz, start = *freq;
+	int i, max_probes, found = 0;
+	long t0 = now_us();
+	struct sw_seek_stats st;
+
+	memset(&st, 0, sizeof(st));
+	if (stats)
+		*stats = st;
+
+	if (tuner_band_range(&dev->tuner, plan, &lo, &hi) < 0)
+		return -1;
+
+	/* one lap of the band at most, wrapping like the hardware seek, and
+	 * only on the channels of the plan */
+	max_probes = (hi - lo) / coarse + 2;
+	f = band_snap(start);
+	f = f < lo ? lo : f > hi ? hi : f;
+
+	for (i = 0; i < max_probes && !found; i++) {
+		unsigned int peak = 0;
+
+		if (now_us() - t0 > SW_SEEK_DEADLINE_MS * 1000L)
+			break;
+
+		/* the band edges are always probed before wrapping */
+		if (upward)
+			f = f >= hi ? lo : (f + coarse > hi ? hi : f + coarse);
+		else
+			f = f <= lo ? hi : (f < lo + coarse ? lo : f - coarse);
+
+		st.probes++;
+
+		/* early rejection, nothing around here */
+		if (probe(dev, f) < SW_SEEK_REJECT)
+			continue;
+
+		if (find_peak(dev, f, lo, hi, plan->step_khz, coarse, start,
+					&peak, &st.refines) >= SW_SEEK_HIT) {
+			if (tune(dev, peak) == 0) {
+				*freq = peak;
+				found = 1;
+			}
+		}
+	}
+
+	/* nothing found, go back to where the user was */
+	if (!found)
+		tune(dev, start);
+
+	st.elapsed_ms = (now_us() - t0) / 1000;
+	st.settle_us = dev->settle_us;
+
+	if (stats)
+		*stats = st;
+
+	return found ? 0 : -1;
+}
+
+/* one slice of a band scan, run by one thread per device */
+struct scan_job {
+	struct tuner_dev *dev;
+	const struct band_plan *plan;
+	unsigned int lo, hi;
+	struct station found[64];
+	int count;
+	int refines;
+};
+
+static void *scan_worker(void *arg)
+{
+	struct scan_job *job = arg;
+	unsigned int step = job->plan->step_khz;
+	struct v4l2_frequency freq;
+	unsigned int lo, hi, f;
+
+	memset(&freq, 0, sizeof(freq));
+	tuner_ioctl(job->dev->fd, VIDIOC_G_FREQUENCY, &freq);
+
+	if (tuner_band_range(&job->dev->tuner, job->plan, &lo, &hi) < 0)
+		return NULL;
+
+	for (f = job->lo; f <= job->hi; f += job->plan->coarse_khz) {
+		unsigned int peak = 0;
+		int sig;
+
+		if (probe(job->dev, f) < SW_SEEK_REJECT)
+			continue;
+
+		sig = find_peak(job->dev, f, lo, hi, step, job->plan->coarse_khz, 0,
+				&peak, &job->refines);
+		if (sig < SW_SEEK_HIT)
+			continue;
+
+		/* two coarse probes can climb to the same station, a channel
+		 * or two apart with noise */
+		if (job->count && job->found[job->count - 1].khz + job->plan->coarse_khz > peak) {
+			if (sig > job->found[job->count - 1].signal) {
+				job->found[job->count - 1].khz = peak;
+				job->found[job->count - 1].signal = sig;
+			}
+			continue;
+		}
+
+		if (job->count < sizeof(job->found) / sizeof(job->found[0])) {
+			job->found[job->count].khz = peak;
+			job->found[job->count].signal = sig;
+			job->count++;
+		}
+	}
+
+	/* leave the device where it was */
+	tuner_ioctl(job->dev->fd, VIDIOC_S_FREQUENCY, &freq);
+
+	return NULL;
+}
+
+int tuner_scan(struct tuner_dev *devs, int count, struct station *stations,
+		int max, long *elapsed_ms)
+{
+	struct scan_job jobs[MAX_TUNERS];
+	pthread_t threads[MAX_TUNERS];
+	int started[MAX_TUNERS];
+	const struct band_plan *plan = active;
+	unsigned int lo, hi, slice, coarse = plan->coarse_khz;
+	long t0 = now_us();
+	int i, j, n = 0;
+
+	if (elapsed_ms)
+		*elapsed_ms = 0;
+
+	if (count > MAX_TUNERS)
+		count = MAX_TUNERS;
+	if (count <= 0 || tuner_band_range(&devs[0].tuner, plan, &lo, &hi) < 0)
+		return 0;
+
+	/* slices start on the coarse raster, so they don't overlap */
+	slice = ((hi - lo) / count + coarse - 1) / coarse * coarse;
+
+	for (i = 0; i < count; i++) {
+		memset(&jobs[i], 0, sizeof(jobs[i]));
+		jobs[i].dev = &devs[i];
+		jobs[i].plan = plan;
+		jobs[i].lo = lo + i * slice;
+		jobs[i].hi = i == count - 1 || jobs[i].lo + slice > hi ? hi : jobs[i].lo + slice - 1;
+
+		started[i] = count > 1 && !pthread_create(&threads[i], NULL, scan_worker, &jobs[i]);
+
+		/* no thread, do it from here */
+		if (!started[i])
+			scan_worker(&jobs[i]);
+	}
+
+	/* slices are in frequency order, just join them */
+	for (i = 0; i < count; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+
+		for (j = 0; j < jobs[i].count && n < max; j++) {
+			/* the same station seen from both sides of a slice edge */
+			if (n && stations[n - 1].khz + coarse > jobs[i].found[j].khz) {
+				if (jobs[i].found[j].signal > stations[n - 1].signal)
+					stations[n - 1] = jobs[i].found[j];
+				continue;
+			}
+			stations[n++] = jobs[i].found[j];
+		}
+	}
+
+	if (elapsed_ms)
+		*elapsed_ms = (now_us() - t0) / 1000;
+
+	return n;
+}
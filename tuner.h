@@ -0,0 +1,125 @@
+/*
+ * tuner.h - Low level tuner access shared by radio_settings.c and the tools
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/videodev2.h>
+
+/* every band plan fits in here, in kHz */
+#define BAND_MIN_KHZ 65900
+#define BAND_MAX_KHZ 108000
+
+/* regions with an FM band of their own, see band_plans in tuner.c */
+enum band_regions {
+	BAND_WIDE,           /* 76.5 - 108 MHz, what the player always used */
+	BAND_EUROPE,         /* ITU region 1, and most of the world */
+	BAND_AMERICAS,       /* stations on the odd tenths */
+	BAND_JAPAN,
+	BAND_OIRT,           /* the old eastern European band */
+	BAND_REGIONS
+};
+
+struct band_plan {
+	const char *name;    /* as written in ~/.radioplayer/region */
+	unsigned int min_khz, max_khz;
+	unsigned int step_khz;      /* channel raster */
+	unsigned int coarse_khz;    /* software seek probes, a multiple of step_khz */
+	unsigned int channels;
+	int deemphasis_us;   /* 50 or 75, 0 leaves the tuner as it is */
+};
+
+/* the plan of region, BAND_WIDE for an unknown one */
+const struct band_plan *band_plan(int region);
+
+/* region called name, or -1 */
+int band_find(const char *name);
+
+/* the plan of the seeks, the scans and the UI, BAND_WIDE until selected */
+const struct band_plan *band_active(void);
+void band_select(int region);
+
+/* the channel of the active plan nearest to khz */
+unsigned int band_snap(unsigned int khz);
+
+/* Channels of plan this tuner can receive, lo and hi are on the raster.
+ * Returns -1 if there are none.
+ */
+int tuner_band_range(const struct v4l2_tuner *tuner, const struct band_plan *plan,
+		unsigned int *lo, unsigned int *hi);
+
+/* software seek tuning, signal values are in the v4l2 0..65535 scale; the
+ * coarse probes are at least SW_SEEK_COARSE_KHZ apart, on the raster of the
+ * band plan, and a peak is refined on the channels next to it */
+#define SW_SEEK_COARSE_KHZ   200
+#define SW_SEEK_REJECT       8192    /* below this a coarse probe is dropped */
+#define SW_SEEK_HIT          26000   /* minimum peak signal to stop on */
+#define SW_SEEK_DEADLINE_MS  8000    /* a full band seek never takes longer */
+
+#define SW_SETTLE_MIN_US     2000
+#define SW_SETTLE_MAX_US     60000
+#define SW_SETTLE_INIT_US    20000
+
+#define MAX_TUNERS 8
+
+/* one radio device and everything we know about it */
+struct tuner_dev {
+	int fd;
+	char path[32];
+	struct v4l2_tuner tuner;
+	int hw_seek;         /* VIDIOC_S_HW_FREQ_SEEK works */
+	long settle_us;      /* adaptive settle time of the software seek */
+	volatile unsigned int probe_khz;  /* last frequency tuned, in kHz */
+};
+
+/* a station found by a band scan */
+struct station {
+	unsigned int khz;
+	int signal;
+};
+
+/* what the last software seek did, useful to tune and benchmark it */
+struct sw_seek_stats {
+	int probes;          /* coarse probes */
+	int refines;         /* fine probes around candidate peaks */
+	long elapsed_ms;     /* wall time of the whole seek */
+	long settle_us;      /* adaptive settle time after the seek */
+};
+
+/* ioctl on a real v4l2 radio fd or on a simulated tuner (see tuner_sim.h) */
+int tuner_ioctl(int fd, unsigned long request, void *arg);
+
+/* convert between kHz and the v4l2 frequency units of this tuner */
+unsigned int tuner_khz_to_units(const struct v4l2_tuner *tuner, unsigned int khz);
+unsigned int tuner_units_to_khz(const struct v4l2_tuner *tuner, unsigned int units);
+
+/* returns 1 if the device announces VIDIOC_S_HW_FREQ_SEEK support */
+int tuner_has_hw_seek(int fd, const struct v4l2_tuner *tuner);
+
+/* Open every /dev/radio* device, or RADIO_SIM simulated tuners if that
+ * variable is set. Returns the number of devices opened.
+ */
+int tuner_enumerate(struct tuner_dev *devs, int max);
+
+/* fill dev for an already opened fd and query its tuner, 0 on success */
+int tuner_dev_init(struct tuner_dev *dev, int fd, const char *path);
+void tuner_dev_close(struct tuner_dev *dev);
+
+/* Seek the next (upward = 1) or previous station using only VIDIOC_S_FREQUENCY
+ * and VIDIOC_G_TUNER. freq is in kHz and is updated with the station found.
+ * Returns 0 when a station was found, -1 otherwise (freq is left untouched).
+ */
+int sw_seek(struct tuner_dev *dev, unsigned int *freq, int upward,
+		struct sw_seek_stats *stats);
+
+/* Find every station of the band, sorted by frequency. The band is split
+ * in one slice per device and the slices are scanned in parallel. Each
+ * device is tuned back to its frequency at the end.
+ * Returns the number of stations stored in stations.
+ */
+int tuner_scan(struct tuner_dev *devs, int count, struct station *stations,
+		int max, long *elapsed_ms);
@@ -0,0 +1,184 @@
+/*
+ * tuner_sim.c - Simulated v4l2 radio tuner. It knows a fixed set of stations
+ *               and needs some time to lock after each tune, like the real one.
+ *               It has no hardware seek, so the software seek is used.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <linux/videodev2.h>
+#include <string.h>
+#include <time.h>
+
+#include "tuner_sim.h"
+
+/* the signal of a station is gone this far from its carrier, in kHz */
+#define SIM_FALLOFF_KHZ 150
+
+#define SIM_NOISE_FLOOR 1500
+
+struct sim_station {
+	unsigned int khz;
+	int strength;
+};
+
+static const struct sim_station stations[] = {
+	{ 77300, 41000 }, { 79900, 30000 }, { 81200, 52000 }, { 84500, 28000 },
+	{ 87700, 61000 }, { 89100, 45000 }, { 91500, 33000 }, { 93300, 58000 },
+	{ 94100, 22000 }, { 95700, 47000 }, { 97100, 39000 }, { 98500, 63000 },
+	{ 99900, 36000 }, { 101300, 54000 }, { 102700, 27000 }, { 104100, 49000 },
+	{ 105900, 31000 }, { 107500, 44000 }
+};
+
+struct sim_tuner {
+	int in_use;
+	long lock_us;
+	unsigned int freq;      /* 62.5 Hz units */
+	long tuned_at;
+};
+
+static struct sim_tuner sims[TUNER_SIM_MAX];
+
+static long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+int tuner_sim_open(long lock_us)
+{
+	int i;
+
+	for (i = 0; i < TUNER_SIM_MAX; i++) {
+		if (!sims[i].in_use) {
+			memset(&sims[i], 0, sizeof(sims[i]));
+			sims[i].in_use = 1;
+			sims[i].lock_us = lock_us;
+			sims[i].freq = 87500 * 16;
+			return TUNER_SIM_FD_BASE + i;
+		}
+	}
+
+	errno = EMFILE;
+	return -1;
+}
+
+void tuner_sim_close(int fd)
+{
+	if (tuner_sim_is_fd(fd))
+		sims[fd - TUNER_SIM_FD_BASE].in_use = 0;
+}
+
+int tuner_sim_is_fd(int fd)
+{
+	return fd >= TUNER_SIM_FD_BASE && fd < TUNER_SIM_FD_BASE + TUNER_SIM_MAX &&
+		sims[fd - TUNER_SIM_FD_BASE].in_use;
+}
+
+/* signal at the current frequency, ramping up while the tuner locks */
+static int sim_signal(struct sim_tuner *sim)
+{
+	unsigned int i, khz = (sim->freq + 8) / 16;
+	long elapsed = now_us() - sim->tuned_at;
+	int best = SIM_NOISE_FLOOR;
+
+	for (i = 0; i < sizeof(stations) / sizeof(stations[0]); i++) {
+		int d = (int)khz - (int)stations[i].khz;
+		int sig;
+
+		if (d < 0)
+			d = -d;
+		if (d >= SIM_FALLOFF_KHZ)
+			continue;
+
+		sig = stations[i].strength * (SIM_FALLOFF_KHZ - d) / SIM_FALLOFF_KHZ;
+		if (sig > best)
+			best = sig;
+	}
+
+	if (elapsed < sim->lock_us)
+		best = (long long)best * elapsed / sim->lock_us;
+
+	return best;
+}
+
+int tuner_sim_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct sim_tuner *sim;
+
+	if (!tuner_sim_is_fd(fd)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	sim = &sims[fd - TUNER_SIM_FD_BASE];
+
+	switch (request) {
+	case VIDIOC_QUERYCAP: {
+		struct v4l2_capability *cap = arg;
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "radio-sim");
+		strcpy((char *)cap->card, "Simulated FM tuner");
+		cap->capabilities = V4L2_CAP_TUNER | V4L2_CAP_RADIO;
+		return 0;
+	}
+	case VIDIOC_G_TUNER: {
+		struct v4l2_tuner *tuner = arg;
+		int sig = sim_signal(sim);
+
+		memset(tuner, 0, sizeof(*tuner));
+		strcpy((char *)tuner->name, "FM");
+		tuner->type = V4L2_TUNER_RADIO;
+		tuner->capability = V4L2_TUNER_CAP_LOW | V4L2_TUNER_CAP_STEREO;
+		tuner->rangelow = 76000 * 16;
+		tuner->rangehigh = 108000 * 16;
+		tuner->signal = sig;
+		tuner->rxsubchans = sig > 40000 ? V4L2_TUNER_SUB_STEREO : V4L2_TUNER_SUB_MONO;
+		tuner->audmode = V4L2_TUNER_MODE_STEREO;
+		return 0;
+	}
+	case VIDIOC_G_FREQUENCY: {
+		struct v4l2_frequency *freq = arg;
+
+		freq->type = V4L2_TUNER_RADIO;
+		freq->frequency = sim->freq;
+		return 0;
+	}
+	case VIDIOC_S_FREQUENCY: {
+		struct v4l2_frequency *freq = arg;
+
+		if (freq->frequency < 76000 * 16 || freq->frequency > 108000 * 16) {
+			errno = EINVAL;
+			return -1;
+		}
+		sim->freq = freq->frequency;
+		sim->tuned_at = now_us();
+		return 0;
+	}
+	case VIDIOC_S_TUNER:
+	case VIDIOC_S_CTRL:
+		return 0;
+	case VIDIOC_G_CTRL:
+		((struct v4l2_control *)arg)->value = 0;
+		return 0;
+	case VIDIOC_S_HW_FREQ_SEEK:
+		errno = ENOTTY;
+		return -1;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
@@ -0,0 +1,26 @@
+/*
+ * tuner_sim.h - Simulated v4l2 radio tuner, used to run the tuner code on
+ *               a host without /dev/radio*
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* simulated fds never collide with the small fds of the process */
+#define TUNER_SIM_FD_BASE 0x7000
+#define TUNER_SIM_MAX 8
+
+/* time a simulated tuner needs to lock after a tune, in us */
+#define TUNER_SIM_LOCK_US 8000
+
+/* open a new simulated tuner, returns its fake fd or -1 */
+int tuner_sim_open(long lock_us);
+void tuner_sim_close(int fd);
+
+int tuner_sim_is_fd(int fd);
+
+/* the subset of the v4l2 radio ioctls used by the application */
+int tuner_sim_ioctl(int fd, unsigned long request, void *arg);
@@ -0,0 +1,201 @@
+/*
+ * verify.c - Classify a short window of captured audio as program, silence
+ *            or noise. The kernels work on fixed size blocks with independent
+ *            accumulators, so the compiler can unroll and vectorise them.
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "fft.h"
+#include "verify.h"
+
+#if VERIFY_WINDOW != FFT_SIZE
+#error "the verification window is one FFT"
+#endif
+
+/* spectral flatness is measured from 100 Hz to 8 kHz */
+#define FLAT_FIRST_BIN (100 * VERIFY_WINDOW / CAPTURE_RATE + 1)
+#define FLAT_LAST_BIN (8000 * VERIFY_WINDOW / CAPTURE_RATE)
+
+static float window[VERIFY_WINDOW];
+static int tables_ready;
+
+static void init_tables(void)
+{
+	int i;
+
+	for (i = 0; i < VERIFY_WINDOW; i++)
+		window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / VERIFY_WINDOW);
+
+	fft_init();
+	tables_ready = 1;
+}
+
+/* sum of squares, four accumulators to break the dependency chain */
+static int64_t energy_kernel(const short *s)
+{
+	int64_t a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+	int i;
+
+	for (i = 0; i < VERIFY_WINDOW; i += 4) {
+		a0 += s[i] * s[i];
+		a1 += s[i + 1] * s[i + 1];
+		a2 += s[i + 2] * s[i + 2];
+		a3 += s[i + 3] * s[i + 3];
+	}
+
+	return a0 + a1 + a2 + a3;
+}
+
+/* sign changes between neighbours, branchless */
+static int zcr_kernel(const short *s)
+{
+	int c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+	int i;
+
+	for (i = 0; i < VERIFY_WINDOW - 4; i += 4) {
+		c0 += (unsigned int)(s[i] ^ s[i + 1]) >> 31;
+		c1 += (unsigned int)(s[i + 1] ^ s[i + 2]) >> 31;
+		c2 += (unsigned int)(s[i + 2] ^ s[i + 3]) >> 31;
+		c3 += (unsigned int)(s[i + 3] ^ s[i + 4]) >> 31;
+	}
+
+	return c0 + c1 + c2 + c3;
+}
+
+/* geometric over arithmetic mean of the power spectrum */
+static float flatness_kernel(const short *s)
+{
+	static float re[VERIFY_WINDOW], im[VERIFY_WINDOW];
+	float log_sum = 0, sum = 0;
+	int i, bins = FLAT_LAST_BIN - FLAT_FIRST_BIN + 1;
+
+	for (i = 0; i < VERIFY_WINDOW; i++) {
+		re[i] = s[i] * window[i];
+		im[i] = 0;
+	}
+
+	fft(re, im);
+
+	for (i = FLAT_FIRST_BIN; i <= FLAT_LAST_BIN; i++) {
+		float p = re[i] * re[i] + im[i] * im[i] + 1e-3f;
+
+		log_sum += logf(p);
+		sum += p;
+	}
+
+	return expf(log_sum / bins) / (sum / bins);
+}
+
+void audio_features(const short *samples, struct audio_features *feat)
+{
+	if (!tables_ready)
+		init_tables();
+
+	feat->rms = sqrt((double)energy_kernel(samples) / VERIFY_WINDOW);
+	feat->zcr = (float)zcr_kernel(samples) / VERIFY_WINDOW;
+	feat->flatness = flatness_kernel(samples);
+}
+
+enum audio_class audio_classify(const struct audio_features *feat)
+{
+	if (feat->rms < VERIFY_SILENCE_RMS)
+		return AUDIO_SILENCE;
+
+	if (feat->flatness > VERIFY_NOISE_FLATNESS && feat->zcr > VERIFY_NOISE_ZCR)
+		return AUDIO_NOISE;
+
+	return AUDIO_PROGRAM;
+}
+
+/* window being filled by the capture thread */
+static struct {
+	short samples[VERIFY_WINDOW];
+	int skip;
+	int count;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+} win = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER
+};
+
+static void verify_tap(const short *frames, unsigned int count, void *data)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&win.lock);
+	for (i = 0; i < count && win.count < VERIFY_WINDOW; i++) {
+		if (win.skip) {
+			win.skip--;
+			continue;
+		}
+		/* downmix to mono */
+		win.samples[win.count++] = (frames[2 * i] + frames[2 * i + 1]) / 2;
+	}
+
+	if (win.count == VERIFY_WINDOW)
+		pthread_cond_signal(&win.done);
+	pthread_mutex_unlock(&win.lock);
+}
+
+int verify_station(struct audio_features *feat)
+{
+	struct timespec deadline;
+	int ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += VERIFY_BUDGET_MS * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&win.lock);
+	win.skip = VERIFY_SKIP_FRAMES;
+	win.count = 0;
+	pthread_mutex_unlock(&win.lock);
+
+	if (capture_add_tap(verify_tap, NULL) < 0)
+		return -1;
+
+	pthread_mutex_lock(&win.lock);
+	while (win.count < VERIFY_WINDOW && ret != ETIMEDOUT)
+		ret = pthread_cond_timedwait(&win.done, &win.lock, &deadline);
+	pthread_mutex_unlock(&win.lock);
+
+	capture_remove_tap(verify_tap, NULL);
+
+	if (win.count < VERIFY_WINDOW)
+		return -1;
+
+	audio_features(win.samples, feat);
+
+	return audio_classify(feat);
+}
+
+int verify_enable(int enable)
+{
+	if (enable)
+		return capture_start();
+
+	capture_stop();
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * verify.h - Tell program audio from silence and noise, used to skip dead
+ *            carriers found by the seek
+ *
+ * Author: Marcos Paulo de Souza <marcos.souza.org@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* analysed window, in mono frames (~23 ms at 44.1 kHz) */
+#define VERIFY_WINDOW 1024
+
+/* audio right after a tune is dropped, the tuner is still settling */
+#define VERIFY_SKIP_FRAMES 661
+
+/* a verification never blocks the seek longer than this */
+#define VERIFY_BUDGET_MS 80
+
+/* thresholds of the classifier */
+#define VERIFY_SILENCE_RMS 120       /* about -49 dBFS */
+#define VERIFY_NOISE_FLATNESS 0.40
+#define VERIFY_NOISE_ZCR 0.20
+
+enum audio_class {
+	AUDIO_PROGRAM,
+	AUDIO_SILENCE,
+	AUDIO_NOISE
+};
+
+struct audio_features {
+	int rms;             /* S16 scale */
+	float flatness;      /* 0 tonal .. 1 white noise */
+	float zcr;           /* zero crossings per sample */
+};
+
+/* compute the features of VERIFY_WINDOW mono samples */
+void audio_features(const short *samples, struct audio_features *feat);
+
+enum audio_class audio_classify(const struct audio_features *feat);
+
+/* Capture a window of the station that is playing now and classify it.
+ * Returns -1 if the capture couldn't deliver it within VERIFY_BUDGET_MS.
+ */
+int verify_station(struct audio_features *feat);
+
+/* keep the capture running while the verification is enabled */
+int verify_enable(int enable);